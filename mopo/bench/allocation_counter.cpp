@@ -0,0 +1,51 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+// These live on their own so the compiler doesn't see malloc and free behind
+// every new and delete in the benchmarks.
+
+namespace {
+  long num_allocations = 0;
+} // namespace
+
+void* operator new(size_t size) {
+  num_allocations++;
+  void* memory = malloc(size ? size : 1);
+  if (memory == 0)
+    throw std::bad_alloc();
+  return memory;
+}
+
+void operator delete(void* memory) {
+  free(memory);
+}
+
+void operator delete(void* memory, size_t) {
+  free(memory);
+}
+
+namespace mopo {
+
+  long numAllocations() {
+    return num_allocations;
+  }
+} // namespace mopo
@@ -0,0 +1,626 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Times single processors, router overhead and note handling and writes the
+// results as JSON, one result per line so runs from different commits diff
+// cleanly.
+
+#include "allocation_counter.h"
+#include "delay.h"
+#include "envelope.h"
+#include "filter.h"
+#include "linear_slope.h"
+#include "operators.h"
+#include "oscillator.h"
+#include "processor_router.h"
+#include "smooth_value.h"
+#include "value.h"
+#include "voice_handler.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+#define SAMPLE_RATE 44100
+#define MIN_BUFFER_SIZE 16
+#define MAX_BENCH_BUFFER_SIZE 4096
+#define ROUTER_BUFFER_SIZE 64
+#define REPEATS 3
+#define DEFAULT_SECONDS_PER_RUN 0.02
+#define ENVELOPE_NOTE_SAMPLES 11025
+#define ROUTER_CHAIN_LENGTH 10
+#define VOICE_POLYPHONY 32
+#define VOICE_BUFFER_SIZE 64
+#define FILTER_COEFFICIENT_INTERVAL 16
+#define VOICE_NOTE_SAMPLES 2205
+#define VOICE_SUSTAIN_SAMPLES 22050
+#define MAX_HELD_NOTES 4096
+
+namespace mopo {
+
+  // Outputs a fixed sine wave it writes once, so timing only covers the
+  // processor we are measuring.
+  class SignalSource : public Processor {
+    public:
+      SignalSource(mopo_float center, mopo_float depth) :
+          Processor(0, 1), center_(center), depth_(depth) { }
+
+      virtual Processor* clone() const { return new SignalSource(*this); }
+      virtual void process() { }
+      virtual bool rewritesOutputs() const { return false; }
+
+      virtual void setBufferSize(int buffer_size) {
+        Processor::setBufferSize(buffer_size);
+        for (int i = 0; i < buffer_size; ++i)
+          outputs_[0]->buffer[i] = center_ + depth_ * sin(0.05 * i);
+      }
+
+    private:
+      mopo_float center_;
+      mopo_float depth_;
+  };
+
+  // Does nothing. Used to measure what the router costs per processor.
+  class NullProcessor : public Processor {
+    public:
+      NullProcessor() : Processor(1, 1) { }
+
+      virtual Processor* clone() const { return new NullProcessor(*this); }
+      virtual void process() { }
+  };
+
+  // Runs FILTER_BANK_LANES filters through Filter::processBank the way a
+  // voice bank runs its voices' filters, each with its own input and cutoff.
+  // Times cover all of the filters.
+  class FilterBank : public Processor {
+    public:
+      FilterBank(int type, bool modulated) : Processor(0, 1) {
+        for (int l = 0; l < FILTER_BANK_LANES; ++l) {
+          Filter* filter = new Filter();
+          filter->setCoefficientInterval(FILTER_COEFFICIENT_INTERVAL);
+          plugFilter(filter, new SignalSource(0.0, 0.9 - 0.1 * l),
+                     Filter::kAudio);
+          plugFilter(filter, new Value(type), Filter::kType);
+          if (modulated) {
+            plugFilter(filter, new SignalSource(1000.0 + 200.0 * l, 800.0),
+                       Filter::kCutoff);
+          }
+          else
+            plugFilter(filter, new Value(1000.0 + 200.0 * l), Filter::kCutoff);
+          plugFilter(filter, new Value(2.0), Filter::kResonance);
+          processors_.push_back(filter);
+          filters_[l] = filter;
+        }
+      }
+
+      virtual Processor* clone() const { return new FilterBank(*this); }
+      virtual void process() {
+        filters_[0]->processBank(filters_, FILTER_BANK_LANES);
+      }
+
+      virtual void setSampleRate(int sample_rate) {
+        Processor::setSampleRate(sample_rate);
+        for (size_t i = 0; i < processors_.size(); ++i)
+          processors_[i]->setSampleRate(sample_rate);
+      }
+
+      virtual void setBufferSize(int buffer_size) {
+        Processor::setBufferSize(buffer_size);
+        for (size_t i = 0; i < processors_.size(); ++i)
+          processors_[i]->setBufferSize(buffer_size);
+      }
+
+    private:
+      void plugFilter(Filter* filter, Processor* source, int index) {
+        filter->plug(source, index);
+        processors_.push_back(source);
+      }
+
+      Processor* filters_[FILTER_BANK_LANES];
+      std::vector<Processor*> processors_;
+  };
+
+  // A processor under test and everything feeding it. Processors don't have
+  // virtual destructors so these live until we exit.
+  class ProcessorBenchmark {
+    public:
+      ProcessorBenchmark(const std::string& name, Processor* processor) :
+          name_(name), processor_(processor) { }
+
+      virtual ~ProcessorBenchmark() { }
+
+      const std::string& name() const { return name_; }
+
+      // Plugs _source_ into input _index_ of the tested processor.
+      void plug(Processor* source, int index) {
+        inputs_.push_back(source);
+        processor_->plug(source, index);
+      }
+
+      void setBufferSize(int buffer_size) {
+        for (size_t i = 0; i < inputs_.size(); ++i) {
+          inputs_[i]->setSampleRate(SAMPLE_RATE);
+          inputs_[i]->setBufferSize(buffer_size);
+        }
+        processor_->setSampleRate(SAMPLE_RATE);
+        processor_->setBufferSize(buffer_size);
+        buffer_size_ = buffer_size;
+        samples_ = 0;
+      }
+
+      void processBlock() {
+        prepareBlock();
+        processor_->process();
+        samples_ += buffer_size_;
+      }
+
+    protected:
+      // Change inputs between blocks here.
+      virtual void prepareBlock() { }
+
+      std::string name_;
+      Processor* processor_;
+      std::vector<Processor*> inputs_;
+      int buffer_size_;
+      long samples_;
+  };
+
+  // Keeps a SmoothValue moving by flipping its target every block.
+  class SmoothValueBenchmark : public ProcessorBenchmark {
+    public:
+      SmoothValueBenchmark() :
+          ProcessorBenchmark("SmoothValue", new SmoothValue(0.0)) { }
+
+    protected:
+      virtual void prepareBlock() {
+        int block = samples_ / buffer_size_;
+        static_cast<SmoothValue*>(processor_)->set(block % 2);
+      }
+  };
+
+  // Plays notes on an Envelope so it goes through every stage.
+  class EnvelopeBenchmark : public ProcessorBenchmark {
+    public:
+      EnvelopeBenchmark() :
+          ProcessorBenchmark("Envelope", new Envelope()), note_on_(false) {
+        plug(new Value(0.01), Envelope::kAttack);
+        plug(new Value(0.1), Envelope::kDecay);
+        plug(new Value(0.5), Envelope::kSustain);
+        plug(new Value(0.1), Envelope::kRelease);
+        processor_->plug(&trigger_, Envelope::kTrigger);
+      }
+
+    protected:
+      virtual void prepareBlock() {
+        trigger_.clearTrigger();
+        if (samples_ % ENVELOPE_NOTE_SAMPLES < buffer_size_) {
+          note_on_ = !note_on_;
+          trigger_.trigger(note_on_ ? kVoiceOn : kVoiceOff);
+        }
+      }
+
+      Processor::Output trigger_;
+      bool note_on_;
+  };
+
+  // Plays short notes at a fixed rate into a VoiceHandler with a small voice,
+  // stealing voices all the time. The sustain pedal goes up and down too.
+  class NoteStorm {
+    public:
+      NoteStorm(int notes_per_second) :
+          notes_per_second_(notes_per_second), samples_(0), notes_(0),
+          first_held_(0), num_held_(0), sustain_(false) {
+        Value* current_note = new Value();
+        current_note->plug(handler_.note());
+        MidiScale* frequency = new MidiScale();
+        frequency->plug(current_note);
+
+        Oscillator* oscillator = new Oscillator();
+        oscillator->plug(frequency, Oscillator::kFrequency);
+        oscillator->plug(new Value(Wave::kDownSaw), Oscillator::kWaveform);
+
+        Envelope* envelope = new Envelope();
+        envelope->plug(new Value(0.002), Envelope::kAttack);
+        envelope->plug(new Value(0.05), Envelope::kDecay);
+        envelope->plug(new Value(0.5), Envelope::kSustain);
+        envelope->plug(new Value(0.02), Envelope::kRelease);
+        envelope->plug(handler_.voice_event(), Envelope::kTrigger);
+
+        Multiply* amplitude = new Multiply();
+        amplitude->plug(oscillator, 0);
+        amplitude->plug(envelope, 1);
+
+        handler_.addProcessor(current_note);
+        handler_.addProcessor(frequency);
+        handler_.addProcessor(oscillator);
+        handler_.addProcessor(envelope);
+        handler_.addProcessor(amplitude);
+        handler_.setVoiceOutput(amplitude);
+        handler_.setVoiceKiller(envelope);
+        Value* polyphony = new Value(VOICE_POLYPHONY);
+        handler_.addGlobalProcessor(polyphony);
+        handler_.plug(polyphony, VoiceHandler::kPolyphony);
+
+        handler_.setSampleRate(SAMPLE_RATE);
+        handler_.setBufferSize(VOICE_BUFFER_SIZE);
+        handler_.createVoices(VOICE_POLYPHONY);
+      }
+
+      long notes() const { return notes_; }
+
+      void processBlock() {
+        long block_end = samples_ + VOICE_BUFFER_SIZE;
+
+        while (num_held_ && held_[first_held_].off_sample < block_end) {
+          HeldNote& held = held_[first_held_];
+          handler_.noteOff(held.note, held.off_sample - samples_);
+          first_held_ = (first_held_ + 1) % MAX_HELD_NOTES;
+          num_held_--;
+        }
+
+        if (samples_ % VOICE_SUSTAIN_SAMPLES < VOICE_BUFFER_SIZE) {
+          sustain_ = !sustain_;
+          if (sustain_)
+            handler_.sustainOn();
+          else
+            handler_.sustainOff();
+        }
+
+        // Notes start evenly spaced at the given rate.
+        long next = (notes_ * SAMPLE_RATE) / notes_per_second_;
+        while (next < block_end && num_held_ < MAX_HELD_NOTES) {
+          mopo_float note = 36 + (notes_ * 7) % 60;
+          handler_.noteOn(note, 0.8, next - samples_);
+
+          HeldNote& held = held_[(first_held_ + num_held_) % MAX_HELD_NOTES];
+          held.note = note;
+          held.off_sample = next + VOICE_NOTE_SAMPLES;
+          num_held_++;
+          notes_++;
+          next = (notes_ * SAMPLE_RATE) / notes_per_second_;
+        }
+
+        handler_.process();
+        samples_ = block_end;
+      }
+
+    private:
+      struct HeldNote {
+        mopo_float note;
+        long off_sample;
+      };
+
+      VoiceHandler handler_;
+      int notes_per_second_;
+      long samples_;
+      long notes_;
+
+      HeldNote held_[MAX_HELD_NOTES];
+      int first_held_;
+      int num_held_;
+      bool sustain_;
+  };
+
+  namespace {
+    const char* wave_names[] = {
+      "sin",
+      "triangle",
+      "square",
+      "down_saw",
+      "up_saw",
+      "three_step",
+      "four_step",
+      "eight_step",
+      "three_pyramid",
+      "five_pyramid",
+      "nine_pyramid",
+      "white_noise",
+    };
+
+    const char* filter_names[] = {
+      "lp12",
+      "hp12",
+      "bp12",
+      "ap12",
+    };
+
+    // A static cutoff, a cutoff modulated every sample with coefficients
+    // computed every sample and the same modulation at control rate.
+    const char* filter_modes[] = {
+      "static",
+      "modulated",
+      "modulated_control_rate",
+    };
+
+    double currentSeconds() {
+      struct timeval now;
+      gettimeofday(&now, 0);
+      return now.tv_sec + now.tv_usec / 1000000.0;
+    }
+
+    std::vector<ProcessorBenchmark*> createBenchmarks() {
+      std::vector<ProcessorBenchmark*> benchmarks;
+
+      for (int i = 0; i < Wave::kNumWaveforms; ++i) {
+        ProcessorBenchmark* benchmark = new ProcessorBenchmark(
+            std::string("Oscillator/") + wave_names[i], new Oscillator());
+        benchmark->plug(new Value(440.0), Oscillator::kFrequency);
+        benchmark->plug(new Value(i), Oscillator::kWaveform);
+        benchmarks.push_back(benchmark);
+      }
+
+      for (int i = 0; i < Filter::kNumTypes; ++i) {
+        for (int mode = 0; mode < 3; ++mode) {
+          std::string name = std::string("Filter/") + filter_names[i] + "/" +
+                             filter_modes[mode];
+          Filter* filter = new Filter();
+          if (mode == 2)
+            filter->setCoefficientInterval(FILTER_COEFFICIENT_INTERVAL);
+
+          ProcessorBenchmark* benchmark = new ProcessorBenchmark(name, filter);
+          benchmark->plug(new SignalSource(0.0, 0.9), Filter::kAudio);
+          benchmark->plug(new Value(i), Filter::kType);
+          if (mode)
+            benchmark->plug(new SignalSource(2000.0, 1500.0), Filter::kCutoff);
+          else
+            benchmark->plug(new Value(2000.0), Filter::kCutoff);
+          benchmark->plug(new Value(2.0), Filter::kResonance);
+          benchmarks.push_back(benchmark);
+        }
+      }
+
+      for (int i = 0; i < Filter::kNumTypes; ++i) {
+        for (int modulated = 0; modulated < 2; ++modulated) {
+          std::string name = std::string("FilterBank/") + filter_names[i];
+          name += modulated ? "/modulated_control_rate" : "/static";
+          benchmarks.push_back(new ProcessorBenchmark(
+              name, new FilterBank(i, modulated)));
+        }
+      }
+
+      benchmarks.push_back(new EnvelopeBenchmark());
+
+      ProcessorBenchmark* delay = new ProcessorBenchmark("Delay", new Delay());
+      delay->plug(new SignalSource(0.0, 0.9), Delay::kAudio);
+      delay->plug(new Value(0.5), Delay::kWet);
+      delay->plug(new Value(0.25), Delay::kDelayTime);
+      delay->plug(new Value(0.5), Delay::kFeedback);
+      benchmarks.push_back(delay);
+
+      benchmarks.push_back(new SmoothValueBenchmark());
+
+      ProcessorBenchmark* slope =
+          new ProcessorBenchmark("LinearSlope", new LinearSlope());
+      slope->plug(new SignalSource(0.5, 0.5), LinearSlope::kTarget);
+      slope->plug(new Value(0.01), LinearSlope::kRunSeconds);
+      benchmarks.push_back(slope);
+
+      ProcessorBenchmark* midi_scale =
+          new ProcessorBenchmark("MidiScale", new MidiScale());
+      midi_scale->plug(new SignalSource(60.0, 24.0), 0);
+      benchmarks.push_back(midi_scale);
+
+      ProcessorBenchmark* variable_add =
+          new ProcessorBenchmark("VariableAdd", new VariableAdd(4));
+      for (int i = 0; i < 4; ++i)
+        variable_add->plug(new SignalSource(0.0, 0.2 * (i + 1)), i);
+      benchmarks.push_back(variable_add);
+
+      return benchmarks;
+    }
+
+    // Runs _benchmark_ for at least _seconds_ and returns nanoseconds per
+    // sample, the best of a few runs.
+    double timeProcessor(ProcessorBenchmark* benchmark, int buffer_size,
+                         double seconds) {
+      benchmark->setBufferSize(buffer_size);
+      int blocks_per_check = MAX_BENCH_BUFFER_SIZE / buffer_size;
+
+      double best = 0.0;
+      for (int r = 0; r < REPEATS; ++r) {
+        long blocks = 0;
+        double elapsed = 0.0;
+        double start = currentSeconds();
+        while (elapsed < seconds) {
+          for (int i = 0; i < blocks_per_check; ++i)
+            benchmark->processBlock();
+          blocks += blocks_per_check;
+          elapsed = currentSeconds() - start;
+        }
+
+        double ns_per_sample = 1e9 * elapsed / (blocks * buffer_size);
+        if (r == 0 || ns_per_sample < best)
+          best = ns_per_sample;
+      }
+      return best;
+    }
+
+    // Times a router holding _num_nodes_ processors that do nothing, wired
+    // up in short chains. Connecting reorders the whole router so long chains
+    // would take minutes to build. Returns nanoseconds per block, the best of
+    // a few runs, and the time it took to build the graph.
+    double timeRouter(int num_nodes, double seconds, double* build_seconds) {
+      double build_start = currentSeconds();
+      ProcessorRouter router;
+      Processor* last = 0;
+      for (int i = 0; i < num_nodes; ++i) {
+        Processor* node = new NullProcessor();
+        router.addProcessor(node);
+        if (i % ROUTER_CHAIN_LENGTH)
+          node->plug(last);
+        last = node;
+      }
+      *build_seconds = currentSeconds() - build_start;
+
+      router.setSampleRate(SAMPLE_RATE);
+      router.setBufferSize(ROUTER_BUFFER_SIZE);
+      router.process();
+
+      double best = 0.0;
+      for (int r = 0; r < REPEATS; ++r) {
+        long blocks = 0;
+        double elapsed = 0.0;
+        double start = currentSeconds();
+        while (elapsed < seconds) {
+          for (int i = 0; i < 16; ++i)
+            router.process();
+          blocks += 16;
+          elapsed = currentSeconds() - start;
+        }
+
+        double ns_per_block = 1e9 * elapsed / blocks;
+        if (r == 0 || ns_per_block < best)
+          best = ns_per_block;
+      }
+      return best;
+    }
+
+    // Plays _notes_per_second_ notes into a VoiceHandler for at least
+    // _seconds_ after a second of warm up. Returns nanoseconds per block, the
+    // best of a few runs, and the notes played and allocations made while
+    // timing.
+    double timeNotes(int notes_per_second, double seconds,
+                     long* notes, long* allocations) {
+      NoteStorm* storm = new NoteStorm(notes_per_second);
+      for (int i = 0; i < SAMPLE_RATE / VOICE_BUFFER_SIZE; ++i)
+        storm->processBlock();
+
+      long start_notes = storm->notes();
+      long start_allocations = numAllocations();
+      double best = 0.0;
+      for (int r = 0; r < REPEATS; ++r) {
+        long blocks = 0;
+        double elapsed = 0.0;
+        double start = currentSeconds();
+        while (elapsed < seconds) {
+          for (int i = 0; i < 16; ++i)
+            storm->processBlock();
+          blocks += 16;
+          elapsed = currentSeconds() - start;
+        }
+
+        double ns_per_block = 1e9 * elapsed / blocks;
+        if (r == 0 || ns_per_block < best)
+          best = ns_per_block;
+      }
+
+      *notes = storm->notes() - start_notes;
+      *allocations = numAllocations() - start_allocations;
+      return best;
+    }
+  } // namespace
+} // namespace mopo
+
+int main(int argc, char** argv) {
+  double seconds = DEFAULT_SECONDS_PER_RUN;
+  const char* output_name = 0;
+
+  int getopt_response = 0;
+  while (getopt_response != -1) {
+    static const struct option long_options[] = {
+      {"time", required_argument, 0, 't'},
+      {"output", required_argument, 0, 'o'},
+      {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    getopt_response = getopt_long(argc, argv, "t:o:",
+                                  long_options, &option_index);
+
+    switch (getopt_response) {
+      case 't':
+        seconds = atof(optarg);
+        break;
+      case 'o':
+        output_name = optarg;
+        break;
+      case -1:
+        break;
+      default:
+        fprintf(stderr, "Usage: mopo_bench [--time OR -t seconds-per-run]\n"
+                        "                  [--output OR -o results.json]\n");
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  FILE* output = output_name ? fopen(output_name, "w") : stdout;
+  if (output == 0) {
+    fprintf(stderr, "Could not open %s\n", output_name);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(output, "{\n");
+  fprintf(output, "  \"sample_bytes\": %d,\n", (int)sizeof(mopo::mopo_float));
+  fprintf(output, "  \"sample_rate\": %d,\n", SAMPLE_RATE);
+  fprintf(output, "  \"processors\": [\n");
+
+  std::vector<mopo::ProcessorBenchmark*> benchmarks =
+      mopo::createBenchmarks();
+  bool first = true;
+  for (size_t i = 0; i < benchmarks.size(); ++i) {
+    for (int buffer_size = MIN_BUFFER_SIZE;
+         buffer_size <= MAX_BENCH_BUFFER_SIZE; buffer_size *= 2) {
+      double ns = mopo::timeProcessor(benchmarks[i], buffer_size, seconds);
+      fprintf(output, "%s    {\"name\": \"%s\", \"buffer_size\": %d, "
+                      "\"ns_per_sample\": %.3f}",
+              first ? "" : ",\n", benchmarks[i]->name().c_str(),
+              buffer_size, ns);
+      first = false;
+    }
+  }
+
+  fprintf(output, "\n  ],\n");
+  fprintf(output, "  \"routers\": [\n");
+
+  first = true;
+  for (int num_nodes = 10; num_nodes <= 10000; num_nodes *= 10) {
+    double build_seconds = 0.0;
+    double ns = mopo::timeRouter(num_nodes, seconds, &build_seconds);
+    fprintf(output, "%s    {\"nodes\": %d, \"buffer_size\": %d, "
+                    "\"ns_per_block\": %.1f, \"ns_per_node\": %.3f, "
+                    "\"build_ms\": %.3f}",
+            first ? "" : ",\n", num_nodes, ROUTER_BUFFER_SIZE,
+            ns, ns / num_nodes, 1000.0 * build_seconds);
+    first = false;
+  }
+
+  fprintf(output, "\n  ],\n");
+  fprintf(output, "  \"voice_handlers\": [\n");
+
+  first = true;
+  for (int notes_per_second = 1000; notes_per_second <= 16000;
+       notes_per_second *= 4) {
+    long notes = 0;
+    long allocations = 0;
+    double ns = mopo::timeNotes(notes_per_second, seconds,
+                                &notes, &allocations);
+    fprintf(output, "%s    {\"notes_per_second\": %d, \"polyphony\": %d, "
+                    "\"buffer_size\": %d, \"ns_per_block\": %.1f, "
+                    "\"notes\": %ld, \"allocations\": %ld}",
+            first ? "" : ",\n", notes_per_second, VOICE_POLYPHONY,
+            VOICE_BUFFER_SIZE, ns, notes, allocations);
+    first = false;
+  }
+
+  fprintf(output, "\n  ]\n}\n");
+  if (output != stdout)
+    fclose(output);
+  return 0;
+}
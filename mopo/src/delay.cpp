@@ -18,7 +18,14 @@
 
 namespace mopo {
 
-  Delay::Delay() : Processor(Delay::kNumInputs, 1) { }
+  Delay::Delay(mopo_float max_delay_time) :
+      Processor(Delay::kNumInputs, 1), max_delay_time_(max_delay_time),
+      memory_(Memory::sizeFor(max_delay_time, sample_rate_)) { }
+
+  void Delay::setSampleRate(int sample_rate) {
+    Processor::setSampleRate(sample_rate);
+    memory_.resize(Memory::sizeFor(max_delay_time_, sample_rate));
+  }
 
   void Delay::process() {
     for (int i = 0; i < buffer_size_; ++i)
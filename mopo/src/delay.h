@@ -35,11 +35,15 @@ namespace mopo {
         kNumInputs
       };
 
-      Delay();
+      // Holds enough memory for delays up to _max_delay_time_ seconds.
+      Delay(mopo_float max_delay_time = DEFAULT_MAX_DELAY_TIME);
 
       virtual Processor* clone() const { return new Delay(*this); }
       virtual void process();
 
+      // Resizes the delay memory for the new sample rate.
+      virtual void setSampleRate(int sample_rate);
+
     protected:
       mopo_float tick(int i) {
         mopo_float input = inputs_[kAudio]->at(i);
@@ -52,6 +56,7 @@ namespace mopo {
         return INTERPOLATE(input, read, wet);
       }
 
+      mopo_float max_delay_time_;
       Memory memory_;
   };
 } // namespace mopo
@@ -0,0 +1,72 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "denormals.h"
+
+#include "mopo.h"
+
+#if defined(__SSE2__) || defined(__x86_64__)
+#include <xmmintrin.h>
+
+// MXCSR flush to zero and denormals are zero bits.
+#define FLUSH_DENORMAL_BITS 0x8040
+#elif defined(__aarch64__)
+#include <stdint.h>
+
+// FPCR flush to zero bit. It covers inputs as well.
+#define FLUSH_DENORMAL_BITS (1 << 24)
+#endif
+
+namespace mopo {
+
+#if defined(__SSE2__) || defined(__x86_64__)
+  bool flushingDenormals() {
+    return (_mm_getcsr() & FLUSH_DENORMAL_BITS) == FLUSH_DENORMAL_BITS;
+  }
+
+  void setFlushDenormals(bool flush) {
+    unsigned int csr = _mm_getcsr();
+    if (flush)
+      _mm_setcsr(csr | FLUSH_DENORMAL_BITS);
+    else
+      _mm_setcsr(csr & ~FLUSH_DENORMAL_BITS);
+  }
+#elif defined(__aarch64__)
+  bool flushingDenormals() {
+    uint64_t fpcr = 0;
+    asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+    return fpcr & FLUSH_DENORMAL_BITS;
+  }
+
+  void setFlushDenormals(bool flush) {
+    uint64_t fpcr = 0;
+    asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+    if (flush)
+      fpcr |= FLUSH_DENORMAL_BITS;
+    else
+      fpcr &= ~static_cast<uint64_t>(FLUSH_DENORMAL_BITS);
+    asm volatile("msr fpcr, %0" : : "r"(fpcr));
+  }
+#else
+  bool flushingDenormals() {
+    return false;
+  }
+
+  void setFlushDenormals(bool flush) {
+    UNUSED(flush);
+  }
+#endif
+} // namespace mopo
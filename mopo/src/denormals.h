@@ -0,0 +1,53 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef DENORMALS_H
+#define DENORMALS_H
+
+namespace mopo {
+
+  // Decaying state like envelope releases and filter and delay feedback
+  // tails ends up in subnormal numbers, which are many times slower to
+  // compute with on x86. In flush denormals mode results that would be
+  // subnormal are zero (FTZ) and subnormal inputs are read as zero (DAZ).
+  // The mode belongs to the calling thread so every thread that processes
+  // audio has to turn it on. Where the CPU has no such mode these do nothing
+  // and flushingDenormals() returns false.
+  bool flushingDenormals();
+  void setFlushDenormals(bool flush);
+
+  // Sets the calling thread's mode for the lifetime of this object then
+  // puts back what was there before.
+  class ScopedFlushDenormals {
+    public:
+      ScopedFlushDenormals(bool flush = true) :
+          previous_(flushingDenormals()) {
+        if (flush != previous_)
+          setFlushDenormals(flush);
+      }
+
+      ~ScopedFlushDenormals() {
+        if (flushingDenormals() != previous_)
+          setFlushDenormals(previous_);
+      }
+
+    private:
+      bool previous_;
+  };
+} // namespace mopo
+
+#endif // DENORMALS_H
@@ -16,6 +16,9 @@
 
 #include "envelope.h"
 
+#include "utils.h"
+
+#include <algorithm>
 #include <cmath>
 
 #define KILL_TIME 0.02
@@ -24,7 +27,16 @@ namespace mopo {
 
   Envelope::Envelope() :
       Processor(kNumInputs, kNumOutputs), state_(kReleasing),
-      current_value_(0), decay_decay_(0), release_decay_(0) { }
+      current_value_(0), attack_time_(0), decay_time_(-1), release_time_(-1),
+      decay_decay_(0), release_decay_(0) { }
+
+  void Envelope::setSampleRate(int sample_rate) {
+    Processor::setSampleRate(sample_rate);
+
+    // Recompute the decay and release rates next buffer.
+    decay_time_ = -1;
+    release_time_ = -1;
+  }
 
   void Envelope::trigger(mopo_float event, int offset) {
     if (event == kVoiceOn)
@@ -41,53 +53,137 @@ namespace mopo {
 
   void Envelope::process() {
     outputs_[kFinished]->clearTrigger();
-    // Only update decay and release rate once per buffer.
-    mopo_float decay_samples =
-        sample_rate_ * inputs_[kDecay]->at(buffer_size_ - 1);
-    decay_decay_ = pow(CLOSE_ENOUGH, 1.0 / decay_samples);
 
-    mopo_float release_samples =
-        sample_rate_ * inputs_[kRelease]->at(buffer_size_ - 1);
-    release_decay_ = pow(CLOSE_ENOUGH, 1.0 / release_samples);
+    // Only update the attack, decay and release times once per buffer, and
+    // the rates only when the times change.
+    attack_time_ = inputs_[kAttack]->at(buffer_size_ - 1);
 
-    int i = 0;
-    if (inputs_[kTrigger]->source->triggered) {
-      int trigger_offset = inputs_[kRelease]->source->trigger_offset;
+    mopo_float decay_time = inputs_[kDecay]->at(buffer_size_ - 1);
+    if (decay_time != decay_time_) {
+      decay_time_ = decay_time;
+      decay_decay_ = pow(CLOSE_ENOUGH, 1.0 / (sample_rate_ * decay_time));
+    }
+
+    mopo_float release_time = inputs_[kRelease]->at(buffer_size_ - 1);
+    if (release_time != release_time_) {
+      release_time_ = release_time;
+      release_decay_ = pow(CLOSE_ENOUGH, 1.0 / (sample_rate_ * release_time));
+    }
 
-      for (; i < trigger_offset; ++i)
-        outputs_[kValue]->buffer[i] = tick(i);
+    // A finished release stays silent for the whole buffer.
+    bool triggered = inputs_[kTrigger]->source->triggered;
+    outputs_[kValue]->constant = !triggered && state_ == kReleasing &&
+                                 current_value_ == 0.0;
 
-      trigger(inputs_[kTrigger]->source->trigger_value, trigger_offset);
+    int i = 0;
+    if (triggered) {
+      i = inputs_[kTrigger]->source->trigger_offset;
+      processStages(0, i);
+      trigger(inputs_[kTrigger]->source->trigger_value, i);
     }
+    processStages(i, buffer_size_);
 
-    for (; i < buffer_size_; ++i)
-      outputs_[kValue]->buffer[i] = tick(i);
+    // Stop releasing, or decaying to no sustain, once we can't hear it
+    // instead of heading into subnormal numbers.
+    bool to_zero = state_ == kReleasing || (state_ == kDecaying &&
+        inputs_[kSustain]->at(buffer_size_ - 1) == 0.0);
+    if (to_zero && utils::closeToZero(current_value_))
+      current_value_ = 0.0;
   }
 
-  inline mopo_float Envelope::tick(int i) {
-    if (state_ == kAttacking) {
-      if (inputs_[kAttack]->at(i) <= 0)
-        current_value_ = 1;
-      else {
-        mopo_float change = 1.0 / (sample_rate_ * inputs_[kAttack]->at(i));
-        current_value_ = CLAMP(current_value_ + change, 0, 1);
+  void Envelope::processStages(int start, int end) {
+    mopo_float* dest = outputs_[kValue]->buffer;
+    int i = start;
+    while (i < end) {
+      switch (state_) {
+        case kAttacking:
+          i = attack(dest, i, end);
+          break;
+        case kDecaying:
+          i = decay(dest, i, end);
+          break;
+        case kReleasing:
+          i = release(dest, i, end);
+          break;
+        case kKilling:
+          i = kill(dest, i, end);
+          break;
       }
-      if (current_value_ >= 1)
-        state_ = kDecaying;
     }
-    else if (state_ == kDecaying) {
-      current_value_ = INTERPOLATE(inputs_[kSustain]->at(i), current_value_,
-                                   decay_decay_);
+  }
+
+  int Envelope::attack(mopo_float* dest, int start, int end) {
+    if (attack_time_ <= 0.0) {
+      current_value_ = 1.0;
+      dest[start] = current_value_;
+      state_ = kDecaying;
+      return start + 1;
     }
-    else if (state_ == kKilling) {
-      current_value_ -= CLAMP(1 / (KILL_TIME * sample_rate_), 0, 1);
-      if (current_value_ <= 0) {
-        outputs_[kFinished]->trigger(kVoiceReset, i);
-        state_ = kAttacking;
-      }
+
+    // Linear up to 1, finishing on the sample that gets there.
+    mopo_float change = 1.0 / (sample_rate_ * attack_time_);
+    mopo_float from = std::max<mopo_float>(current_value_, 0.0);
+    mopo_float remaining = std::max<mopo_float>(ceil((1.0 - from) / change), 1);
+    // Rounding can leave us a sample late.
+    if (remaining > 1 && from + (remaining - 1) * change >= 1.0 - EPSILON)
+      remaining -= 1;
+    int samples = static_cast<int>(std::min<mopo_float>(end - start,
+                                                         remaining));
+
+    for (int i = 0; i < samples; ++i)
+      dest[start + i] = std::min<mopo_float>(from + (i + 1) * change, 1.0);
+
+    int last = start + samples - 1;
+    if (samples == remaining) {
+      dest[last] = 1.0;
+      state_ = kDecaying;
+    }
+    current_value_ = dest[last];
+    return last + 1;
+  }
+
+  int Envelope::decay(mopo_float* dest, int start, int end) {
+    // Exponential towards the sustain level, which may be moving.
+    const mopo_float* sustain = inputs_[kSustain]->source->buffer;
+    mopo_float value = current_value_;
+    for (int i = start; i < end; ++i) {
+      value = INTERPOLATE(sustain[i], value, decay_decay_);
+      dest[i] = value;
+    }
+    current_value_ = value;
+    return end;
+  }
+
+  int Envelope::release(mopo_float* dest, int start, int end) {
+    mopo_float value = current_value_;
+    for (int i = start; i < end; ++i) {
+      value *= release_decay_;
+      dest[i] = value;
+    }
+    current_value_ = value;
+    return end;
+  }
+
+  int Envelope::kill(mopo_float* dest, int start, int end) {
+    // Linear down to 0 quickly, then tell the voice to start over.
+    mopo_float change = CLAMP(1 / (KILL_TIME * sample_rate_), 0, 1);
+    mopo_float from = current_value_;
+    mopo_float remaining = std::max<mopo_float>(ceil(from / change), 1);
+    if (remaining > 1 && from - (remaining - 1) * change <= EPSILON)
+      remaining -= 1;
+    int samples = static_cast<int>(std::min<mopo_float>(end - start,
+                                                         remaining));
+
+    for (int i = 0; i < samples; ++i)
+      dest[start + i] = std::max<mopo_float>(from - (i + 1) * change, 0.0);
+
+    int last = start + samples - 1;
+    if (samples == remaining) {
+      dest[last] = 0.0;
+      outputs_[kFinished]->trigger(kVoiceReset, last);
+      state_ = kAttacking;
     }
-    else if (state_ == kReleasing)
-      current_value_ *= release_decay_;
-    return current_value_;
+    current_value_ = dest[last];
+    return last + 1;
   }
 } // namespace mopo
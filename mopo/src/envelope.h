@@ -32,7 +32,12 @@ namespace mopo {
   // The reason for this is that technically the decay and release
   // take an extremely long time to finish because they are exponential. But
   // users are used to specifying the amount of time the decay or release take
-  // so we make this compromise of _CLOSE_ENOUGH_.
+  // so we make this compromise of _CLOSE_ENOUGH_. Once the release, or a decay
+  // to a sustain of zero, is silent it stops at zero. A silent release also
+  // marks the value output constant.
+  //
+  // Each buffer is filled one stage at a time. We work out how many samples
+  // are left in the current stage and fill them in one loop.
   class Envelope : public Processor {
     public:
       enum Inputs {
@@ -61,13 +66,33 @@ namespace mopo {
 
       virtual Processor* clone() const { return new Envelope(*this); }
       void process();
+      virtual void setSampleRate(int sample_rate);
+      // Our _kFinished_ output only carries triggers.
+      virtual bool rewritesOutputs() const { return false; }
+      // We'd miss triggers while skipped.
+      virtual bool alwaysActive() const { return true; }
       void trigger(mopo_float event, int offset);
 
+      // The stage and the value at the end of the last buffer.
+      State state() const { return state_; }
+      mopo_float value() const { return current_value_; }
+
     private:
-      mopo_float tick(int i);
+      // Fills the value output from _start_ to _end_ stage by stage.
+      void processStages(int start, int end);
+
+      // Each fills _dest_ from _start_ until _end_ or the end of the stage,
+      // returning where it stopped.
+      int attack(mopo_float* dest, int start, int end);
+      int decay(mopo_float* dest, int start, int end);
+      int release(mopo_float* dest, int start, int end);
+      int kill(mopo_float* dest, int start, int end);
 
       State state_;
       mopo_float current_value_;
+      mopo_float attack_time_;
+      mopo_float decay_time_;
+      mopo_float release_time_;
       mopo_float decay_decay_;
       mopo_float release_decay_;
   };
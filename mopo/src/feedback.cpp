@@ -21,12 +21,18 @@
 namespace mopo {
 
   void Feedback::process() {
-    memcpy(buffer_, inputs_[0]->source->buffer,
+    memcpy(&buffer_[0], inputs_[0]->source->buffer,
            buffer_size_ * sizeof(mopo_float));
     refreshOutput();
   }
 
   void Feedback::refreshOutput() {
-    memcpy(outputs_[0]->buffer, buffer_, MAX_BUFFER_SIZE * sizeof(mopo_float));
+    memcpy(outputs_[0]->buffer, &buffer_[0],
+           buffer_size_ * sizeof(mopo_float));
+  }
+
+  void Feedback::setBufferSize(int buffer_size) {
+    Processor::setBufferSize(buffer_size);
+    buffer_.resize(buffer_size);
   }
 } // namespace mopo
@@ -20,6 +20,8 @@
 
 #include "processor.h"
 
+#include <vector>
+
 namespace mopo {
 
   // A special processor for the purpose of feedback loops in the signal flow.
@@ -27,11 +29,12 @@ namespace mopo {
   // sample feedback processing.
   class Feedback : public Processor {
     public:
-      Feedback() : Processor(1, 1) { }
+      Feedback() : Processor(1, 1), buffer_(buffer_size_) { }
 
       virtual Processor* clone() const { return new Feedback(*this); }
       virtual void process();
       virtual void refreshOutput();
+      virtual void setBufferSize(int buffer_size);
 
       inline void tick(int i) {
         buffer_[i] = inputs_[0]->source->buffer[i];
@@ -47,7 +50,7 @@ namespace mopo {
       }
 
     protected:
-      mopo_float buffer_[MAX_BUFFER_SIZE];
+      std::vector<mopo_float> buffer_;
   };
 } // namespace mopo
 
@@ -16,52 +16,237 @@
 
 #include "filter.h"
 
+#include "utils.h"
+
+#include <algorithm>
 #include <cmath>
 
 namespace mopo {
 
+  namespace {
+    // A sample of each of FILTER_BANK_LANES filters. GCC and Clang compile
+    // math on these to the target's SIMD instructions, splitting it across
+    // registers when they're narrower.
+    typedef mopo_float lane_vector
+        __attribute__((vector_size(FILTER_BANK_LANES * sizeof(mopo_float))));
+  } // namespace
+
   Filter::Filter() : Processor(Filter::kNumInputs, 1) {
+    coefficient_interval_ = 1;
     current_type_ = kNumTypes;
     current_cutoff_ = 0.0;
     current_resonance_ = 0.0;
 
-    in_0_ = in_1_ = in_2_ = 0.0;
-    out_0_ = out_1_ = 0.0;
+    for (int c = 0; c < kNumCoefficients; ++c)
+      coefficients_[c] = 0.0;
     past_in_1_ = past_in_2_ = past_out_1_ = past_out_2_ = 0.0;
   }
 
+  void Filter::setSampleRate(int sample_rate) {
+    Processor::setSampleRate(sample_rate);
+
+    // The coefficients depend on the sample rate, so forget the ones we have.
+    current_type_ = kNumTypes;
+    current_cutoff_ = 0.0;
+    current_resonance_ = 0.0;
+  }
+
+  void Filter::prepare() {
+    Type type = static_cast<Type>(inputs_[kType]->at(0));
+    if (type != current_type_) {
+      current_type_ = type;
+      computeCoefficients(current_type_, inputs_[kCutoff]->at(0),
+                                         inputs_[kResonance]->at(0));
+    }
+  }
+
   void Filter::process() {
-    current_type_ = static_cast<Type>(inputs_[kType]->at(0));
-    computeCoefficients(current_type_, inputs_[kCutoff]->at(0),
-                                       inputs_[kResonance]->at(0));
+    prepare();
 
     int i = 0;
-    if (inputs_[kReset]->source->triggered &&
-        inputs_[kReset]->source->trigger_value == kVoiceReset) {
-      int trigger_offset = inputs_[kReset]->source->trigger_offset;
-      for (; i < trigger_offset; ++i)
-        outputs_[0]->buffer[i] = tick(i);
-
+    if (resetting()) {
+      i = inputs_[kReset]->source->trigger_offset;
+      processSamples(0, i);
       reset();
+
+      // A new note starts on its own coefficients instead of ramping to
+      // them from the last note's.
+      if (i < buffer_size_) {
+        computeCoefficients(current_type_, inputs_[kCutoff]->at(i),
+                                           inputs_[kResonance]->at(i));
+      }
+    }
+    processSamples(i, buffer_size_);
+  }
+
+  void Filter::processSamples(int start, int end) {
+    const mopo_float* audio = inputs_[kAudio]->source->buffer;
+    const mopo_float* cutoff = inputs_[kCutoff]->source->buffer;
+    const mopo_float* resonance = inputs_[kResonance]->source->buffer;
+    mopo_float* dest = outputs_[0]->buffer;
+
+    for (int segment = start; segment < end;
+         segment += coefficient_interval_) {
+      int segment_end = std::min(segment + coefficient_interval_, end);
+      int last = segment_end - 1;
+
+      if (cutoff[last] == current_cutoff_ &&
+          resonance[last] == current_resonance_) {
+        for (int i = segment; i < segment_end; ++i)
+          dest[i] = tick(audio[i], coefficients_);
+        continue;
+      }
+
+      // Ramp from the current coefficients to the ones at the end of the
+      // segment. The next segment starts exactly on those.
+      mopo_float ramp[kNumCoefficients];
+      mopo_float delta[kNumCoefficients];
+      for (int c = 0; c < kNumCoefficients; ++c)
+        ramp[c] = coefficients_[c];
+
+      computeCoefficients(current_type_, cutoff[last], resonance[last]);
+      mopo_float scale = 1.0 / (segment_end - segment);
+      for (int c = 0; c < kNumCoefficients; ++c)
+        delta[c] = scale * (coefficients_[c] - ramp[c]);
+
+      for (int i = segment; i < segment_end; ++i) {
+        for (int c = 0; c < kNumCoefficients; ++c)
+          ramp[c] += delta[c];
+        dest[i] = tick(audio[i], ramp);
+      }
+    }
+  }
+
+  void Filter::processBank(Processor* const* bank, int bank_size) {
+    Filter* lanes[FILTER_BANK_LANES];
+    int num_lanes = 0;
+
+    for (int i = 0; i < bank_size; ++i) {
+      Filter* filter = static_cast<Filter*>(bank[i]);
+
+      // Filters resetting mid buffer go through the single filter path.
+      if (filter->resetting())
+        filter->process();
+      else {
+        lanes[num_lanes++] = filter;
+        if (num_lanes == FILTER_BANK_LANES) {
+          processLanes(lanes, num_lanes);
+          num_lanes = 0;
+        }
+      }
     }
-    for (; i < buffer_size_; ++i)
-      outputs_[0]->buffer[i] = tick(i);
+
+    if (num_lanes)
+      processLanes(lanes, num_lanes);
   }
 
-  inline mopo_float Filter::tick(int i) {
-    mopo_float input = inputs_[kAudio]->at(i);
-    mopo_float cutoff = inputs_[kCutoff]->at(i);
-    mopo_float resonance = inputs_[kResonance]->at(i);
+  void Filter::processLanes(Filter* const* lanes, int num_lanes) {
+    const mopo_float* audio[FILTER_BANK_LANES];
+    const mopo_float* cutoff[FILTER_BANK_LANES];
+    const mopo_float* resonance[FILTER_BANK_LANES];
+    mopo_float* dest[FILTER_BANK_LANES];
+
+    lane_vector coefficients[kNumCoefficients];
+    lane_vector delta[kNumCoefficients];
+    lane_vector past_in_1, past_in_2, past_out_1, past_out_2;
+
+    // Gather the state of every filter into lanes. Lanes without a filter
+    // run a copy of the first one and their output is thrown away.
+    for (int l = 0; l < FILTER_BANK_LANES; ++l) {
+      Filter* filter = lanes[l < num_lanes ? l : 0];
+      if (l < num_lanes) {
+        filter->prepare();
+        dest[l] = filter->outputs_[0]->buffer;
+      }
+
+      audio[l] = filter->inputs_[kAudio]->source->buffer;
+      cutoff[l] = filter->inputs_[kCutoff]->source->buffer;
+      resonance[l] = filter->inputs_[kResonance]->source->buffer;
+
+      for (int c = 0; c < kNumCoefficients; ++c) {
+        coefficients[c][l] = filter->coefficients_[c];
+        delta[c][l] = 0.0;
+      }
+      past_in_1[l] = filter->past_in_1_;
+      past_in_2[l] = filter->past_in_2_;
+      past_out_1[l] = filter->past_out_1_;
+      past_out_2[l] = filter->past_out_2_;
+    }
+
+    // Banked filters are copies of one filter so they share the interval.
+    int buffer_size = lanes[0]->buffer_size_;
+    int interval = lanes[0]->coefficient_interval_;
+    for (int segment = 0; segment < buffer_size; segment += interval) {
+      int segment_end = std::min(segment + interval, buffer_size);
+      int last = segment_end - 1;
+      mopo_float scale = 1.0 / (segment_end - segment);
 
-    if (cutoff != current_cutoff_ || resonance != current_resonance_)
-      computeCoefficients(current_type_, cutoff, resonance);
+      // Lanes whose cutoff and resonance hold still ramp by zero.
+      for (int l = 0; l < num_lanes; ++l) {
+        Filter* filter = lanes[l];
+        if (cutoff[l][last] != filter->current_cutoff_ ||
+            resonance[l][last] != filter->current_resonance_) {
+          filter->computeCoefficients(filter->current_type_,
+                                      cutoff[l][last], resonance[l][last]);
+        }
+        for (int c = 0; c < kNumCoefficients; ++c) {
+          delta[c][l] = scale * (filter->coefficients_[c] -
+                                 coefficients[c][l]);
+        }
+      }
+
+      for (int i = segment; i < segment_end; ++i) {
+        lane_vector input;
+        for (int l = 0; l < FILTER_BANK_LANES; ++l)
+          input[l] = audio[l][i];
+
+        for (int c = 0; c < kNumCoefficients; ++c)
+          coefficients[c] += delta[c];
+
+        lane_vector out;
+        biquad(input, coefficients,
+               past_in_1, past_in_2, past_out_1, past_out_2, out);
+        for (int l = 0; l < num_lanes; ++l)
+          dest[l][i] = out[l];
+      }
+
+      // Land exactly on the coefficients so rounding doesn't build up.
+      for (int l = 0; l < num_lanes; ++l) {
+        for (int c = 0; c < kNumCoefficients; ++c)
+          coefficients[c][l] = lanes[l]->coefficients_[c];
+      }
+    }
+
+    // Scatter the lane state back into the filters.
+    for (int l = 0; l < num_lanes; ++l) {
+      Filter* filter = lanes[l];
+      filter->past_in_1_ = past_in_1[l];
+      filter->past_in_2_ = past_in_2[l];
+      filter->past_out_1_ = past_out_1[l];
+      filter->past_out_2_ = past_out_2[l];
+    }
+  }
+
+  template<class T>
+  inline void Filter::biquad(const T& input, const T* coefficients,
+                             T& past_in_1, T& past_in_2,
+                             T& past_out_1, T& past_out_2, T& out) {
+    out = input * coefficients[kIn0] +
+          past_in_1 * coefficients[kIn1] +
+          past_in_2 * coefficients[kIn2] -
+          past_out_1 * coefficients[kOut0] -
+          past_out_2 * coefficients[kOut1];
+    past_in_2 = past_in_1;
+    past_in_1 = input;
+    past_out_2 = past_out_1;
+    past_out_1 = out;
+  }
 
-    mopo_float out = input * in_0_ + past_in_1_ * in_1_ + past_in_2_ * in_2_ -
-                     past_out_1_ * out_0_ - past_out_2_ * out_1_;
-    past_in_2_ = past_in_1_;
-    past_in_1_ = input;
-    past_out_2_ = past_out_1_;
-    past_out_1_ = out;
+  inline mopo_float Filter::tick(mopo_float input,
+                                 const mopo_float* coefficients) {
+    mopo_float out;
+    biquad(input, coefficients,
+           past_in_1_, past_in_2_, past_out_1_, past_out_2_, out);
     return out;
   }
 
@@ -72,42 +257,46 @@ namespace mopo {
   inline void Filter::computeCoefficients(Type type,
                                           mopo_float cutoff,
                                           mopo_float resonance) {
-    mopo_float sf = 1.0 / tan(PI * cutoff / sample_rate_);
+    mopo_float sf = 1.0 / utils::fastTan(PI * cutoff / sample_rate_);
     mopo_float sf_squared = sf * sf;
-    mopo_float norm = 1.0 + 1.0 / resonance * sf + sf_squared;
+    mopo_float damping = sf / resonance;
+    mopo_float norm = 1.0 / (1.0 + damping + sf_squared);
+    mopo_float feedback_0 = 2.0 * (1.0 - sf_squared) * norm;
+    mopo_float feedback_1 = (1.0 - damping + sf_squared) * norm;
 
     switch(type) {
       case kLP12: {
-        in_2_ = in_0_ = 1.0 / norm;
-        in_1_ = 2.0 / norm;
-        out_0_ = 2.0 * (1.0 - sf_squared) / norm;
-        out_1_ = (1.0 - 1.0 / resonance * sf + sf_squared) / norm;
+        coefficients_[kIn2] = coefficients_[kIn0] = norm;
+        coefficients_[kIn1] = 2.0 * norm;
+        coefficients_[kOut0] = feedback_0;
+        coefficients_[kOut1] = feedback_1;
         break;
       }
       case kHP12: {
-        in_2_ = in_0_ = sf_squared / norm;
-        in_1_ = -2.0 * sf_squared / norm;
-        out_0_ = 2.0 * (1.0 - sf_squared) / norm;
-        out_1_ = (1.0 - 1.0 / resonance * sf + sf_squared) / norm;
+        coefficients_[kIn2] = coefficients_[kIn0] = sf_squared * norm;
+        coefficients_[kIn1] = -2.0 * sf_squared * norm;
+        coefficients_[kOut0] = feedback_0;
+        coefficients_[kOut1] = feedback_1;
         break;
       }
       case kBP12: {
-        in_2_ = in_0_ = sf / norm;
-        in_1_ = 0.0;
-        out_0_ = 2.0 * (1.0 - sf_squared) / norm;
-        out_1_ = (1.0 - 1.0 / resonance * sf + sf_squared) / norm;
+        coefficients_[kIn2] = coefficients_[kIn0] = sf * norm;
+        coefficients_[kIn1] = 0.0;
+        coefficients_[kOut0] = feedback_0;
+        coefficients_[kOut1] = feedback_1;
         break;
       }
       case kAP12: {
-        in_0_ = 1.0 / norm;
-        in_1_ = -2.0 * (1.0 - sf_squared) / norm;
-        in_2_ = (1.0 - 1.0 / resonance * sf + sf_squared) / norm;
-        out_0_ = -in_1_;
-        out_1_ = in_2_;
+        coefficients_[kIn0] = norm;
+        coefficients_[kIn1] = -feedback_0;
+        coefficients_[kIn2] = feedback_1;
+        coefficients_[kOut0] = feedback_0;
+        coefficients_[kOut1] = feedback_1;
         break;
       }
       default:
-        in_2_ = in_1_ = in_0_ = out_1_ = out_0_ = 0.0;
+        for (int c = 0; c < kNumCoefficients; ++c)
+          coefficients_[c] = 0.0;
     }
 
     current_cutoff_ = cutoff;
@@ -20,6 +20,8 @@
 
 #include "processor.h"
 
+#define FILTER_BANK_LANES 8
+
 namespace mopo {
 
   // 12 dB per octave filters. There is a low pass filter, high pass filter,
@@ -46,19 +48,59 @@ namespace mopo {
       Filter();
 
       virtual Processor* clone() const { return new Filter(*this); }
+      virtual void setSampleRate(int sample_rate);
       virtual void process();
 
+      // Runs the filters of a voice bank FILTER_BANK_LANES at a time. Only
+      // VoiceHandler's voice bank mode calls this, voices processed one by
+      // one or on voice threads use process().
+      virtual void processBank(Processor* const* bank, int bank_size);
+
+      // Only follows cutoff and resonance changes every _samples_ samples,
+      // linearly interpolating the coefficients in between. Defaults to 1,
+      // every sample. Set it before the filter is copied into voices.
+      void setCoefficientInterval(int samples) {
+        MOPO_ASSERT(samples > 0);
+        coefficient_interval_ = samples;
+      }
+
     private:
-      mopo_float tick(int i);
+      enum Coefficients {
+        kIn0,
+        kIn1,
+        kIn2,
+        kOut0,
+        kOut1,
+        kNumCoefficients
+      };
+
+      // Runs the biquads of up to FILTER_BANK_LANES filters side by side, one
+      // filter per SIMD lane.
+      static void processLanes(Filter* const* lanes, int num_lanes);
+
+      // One biquad step from _input_ to _out_. Single filters and lanes both
+      // run this so their output matches bit for bit.
+      template<class T>
+      static void biquad(const T& input, const T* coefficients,
+                         T& past_in_1, T& past_in_2,
+                         T& past_out_1, T& past_out_2, T& out);
+
+      bool resetting() const {
+        return inputs_[kReset]->source->triggered &&
+               inputs_[kReset]->source->trigger_value == kVoiceReset;
+      }
+      void prepare();
+      void processSamples(int start, int end);
+      mopo_float tick(mopo_float input, const mopo_float* coefficients);
       void reset();
       void computeCoefficients(Type type, mopo_float cutoff,
                                           mopo_float resonance);
 
+      int coefficient_interval_;
       Type current_type_;
       mopo_float current_cutoff_, current_resonance_;
 
-      mopo_float in_0_, in_1_, in_2_;
-      mopo_float out_0_, out_1_;
+      mopo_float coefficients_[kNumCoefficients];
 
       mopo_float past_in_1_, past_in_2_;
       mopo_float past_out_1_, past_out_2_;
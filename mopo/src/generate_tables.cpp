@@ -0,0 +1,165 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Writes the definitions of the lookup tables as C++ to standard output. The
+// build compiles them into libmopo so the tables are read only data instead
+// of being computed by every process that starts up.
+
+#include "midi_lookup.h"
+#include "wave.h"
+
+#include <cmath>
+#include <cstdio>
+
+#define TABLE_SIZE (LOOKUP_SIZE + 1)
+
+namespace mopo {
+  namespace {
+    // Enough digits for a double or a float to read back exactly.
+    void printDoubles(const char* declaration, const double* values,
+                      int size) {
+      printf("  %s = {\n", declaration);
+      for (int i = 0; i < size; ++i)
+        printf("    %.17g,\n", values[i]);
+      printf("  };\n\n");
+    }
+
+    void printFloats(const float* values, int size) {
+      for (int i = 0; i < size; ++i)
+        printf("      %.9g,\n", values[i]);
+    }
+
+    void printInts(const char* declaration, const int* values, int size) {
+      printf("  %s = {\n", declaration);
+      for (int i = 0; i < size; ++i)
+        printf("    %d,\n", values[i]);
+      printf("  };\n\n");
+    }
+
+    // The amplitude of harmonic _harmonic_ of _mipmap_'s waveform.
+    double harmonicAmplitude(int mipmap, int harmonic) {
+      switch (mipmap) {
+        case WaveLookup::kSquareMipmap:
+          if (harmonic % 2 == 0)
+            return 0.0;
+          return 4.0 / (PI * harmonic);
+        case WaveLookup::kSawMipmap:
+          return -2.0 / (PI * harmonic);
+        case WaveLookup::kTriangleMipmap:
+          if (harmonic % 2 == 0)
+            return 0.0;
+          if (harmonic % 4 == 1)
+            return 8.0 / (PI * PI * harmonic * harmonic);
+          return -8.0 / (PI * PI * harmonic * harmonic);
+        default:
+          return 0.0;
+      }
+    }
+
+    // Each level adds the next octave of harmonics to the one before.
+    void printMipmap(int mipmap, const double* sin_table) {
+      static double sum[LOOKUP_SIZE];
+      static float table[TABLE_SIZE];
+      for (int i = 0; i < LOOKUP_SIZE; ++i)
+        sum[i] = 0.0;
+
+      printf("    {\n");
+      int harmonic = 1;
+      for (int level = 0; level < MIPMAP_LEVELS; ++level) {
+        for (; harmonic <= (1 << level); ++harmonic) {
+          double amplitude = harmonicAmplitude(mipmap, harmonic);
+          if (amplitude == 0.0)
+            continue;
+
+          for (int i = 0; i < LOOKUP_SIZE; ++i)
+            sum[i] += amplitude * sin_table[(harmonic * i) % LOOKUP_SIZE];
+        }
+
+        for (int i = 0; i < LOOKUP_SIZE; ++i)
+          table[i] = sum[i];
+        table[LOOKUP_SIZE] = sum[0];
+        printFloats(table, TABLE_SIZE);
+      }
+      printf("    },\n");
+    }
+
+    void printTables() {
+      static double sin_table[TABLE_SIZE];
+      for (int i = 0; i < TABLE_SIZE; ++i)
+        sin_table[i] = sin((2 * PI * i) / LOOKUP_SIZE);
+
+      // Level n holds exactly 2^n harmonics, so 2^n harmonics read it alone.
+      // Up to 2^(n + 1) harmonics the octave above fades in until level
+      // n + 1 is read alone. The last level covers MAX_HARMONICS by itself.
+      int low_level[MAX_HARMONICS];
+      int high_level[MAX_HARMONICS];
+      double fade[MAX_HARMONICS];
+      for (int h = 0; h < MAX_HARMONICS; ++h) {
+        int num_harmonics = h + 1;
+        int level = 0;
+        while ((2 << level) <= num_harmonics)
+          level++;
+
+        low_level[h] = level * TABLE_SIZE;
+        if (level == MIPMAP_LEVELS - 1) {
+          high_level[h] = low_level[h];
+          fade[h] = 0.0;
+        }
+        else {
+          high_level[h] = (level + 1) * TABLE_SIZE;
+          fade[h] = (num_harmonics - (1 << level)) / (1.0 * (1 << level));
+        }
+      }
+
+      static double frequencies[MAX_CENTS + 1];
+      double cents_per_octave = CENTS_PER_NOTE * NOTES_PER_OCTAVE;
+      for (int i = 0; i <= MAX_CENTS; ++i)
+        frequencies[i] = MIDI_0_FREQUENCY * pow(2, i / cents_per_octave);
+
+      printf("// Generated by generate_tables, do not edit.\n\n");
+      printf("#include \"midi_lookup.h\"\n");
+      printf("#include \"wave.h\"\n\n");
+      printf("namespace mopo {\n\n");
+
+      printDoubles("const mopo_float WaveLookup::sin_[LOOKUP_SIZE + 1]",
+                   sin_table, TABLE_SIZE);
+
+      printf("  const float WaveLookup::mipmaps_[kNumMipmaps]"
+             "[MIPMAP_LEVELS * (LOOKUP_SIZE + 1)] = {\n");
+      for (int m = 0; m < WaveLookup::kNumMipmaps; ++m)
+        printMipmap(m, sin_table);
+      printf("  };\n\n");
+
+      printInts("const int WaveLookup::low_level_[MAX_HARMONICS]",
+                low_level, MAX_HARMONICS);
+      printInts("const int WaveLookup::high_level_[MAX_HARMONICS]",
+                high_level, MAX_HARMONICS);
+      printDoubles("const mopo_float WaveLookup::fade_[MAX_HARMONICS]",
+                   fade, MAX_HARMONICS);
+
+      printDoubles("const mopo_float "
+                   "MidiLookupSingleton::frequency_lookup_[MAX_CENTS + 1]",
+                   frequencies, MAX_CENTS + 1);
+
+      printf("} // namespace mopo\n");
+    }
+  } // namespace
+} // namespace mopo
+
+int main() {
+  mopo::printTables();
+  return 0;
+}
@@ -22,34 +22,53 @@
 
 #include <algorithm>
 #include <cmath>
-#include <cstring>
+#include <vector>
 
-// MAX_MEMORY must be a power of 2.
-#define MAX_MEMORY 1048576
-#define MEMORY_BITMASK 1048575
+// The longest delay a Memory holds if it isn't told otherwise, in seconds.
+#define DEFAULT_MAX_DELAY_TIME 1.0
 
 namespace mopo {
 
   // A processor utility to store a stream of data for later lookup.
   class Memory {
     public:
-      Memory() : offset_(0) {
-        memset(memory_, 0, MAX_MEMORY * sizeof(mopo_float));
+      Memory(int size) { resize(size); }
+
+      // Makes room for at least _size_ samples, rounded up to a power of 2 so
+      // lookups can wrap with a bitmask. This allocates and clears the
+      // history so keep it off the audio thread.
+      void resize(int size) {
+        int capacity = 1;
+        while (capacity < size)
+          capacity *= 2;
+
+        memory_.assign(capacity, 0.0);
+        bitmask_ = capacity - 1;
+        offset_ = 0;
       }
 
+      // Returns the number of samples needed to look _max_delay_time_ seconds
+      // into the past at _sample_rate_, including the interpolation sample.
+      static int sizeFor(mopo_float max_delay_time, int sample_rate) {
+        return static_cast<int>(ceil(max_delay_time * sample_rate)) + 2;
+      }
+
+      int size() const { return memory_.size(); }
+
       inline void push(mopo_float sample) {
-        offset_ = (offset_ + 1) & MEMORY_BITMASK;
+        offset_ = (offset_ + 1) & bitmask_;
         memory_[offset_] = sample;
       }
 
       inline mopo_float getIndex(int index) const {
-        return memory_[(offset_ - index) & MEMORY_BITMASK];
+        return memory_[(offset_ - index) & bitmask_];
       }
 
       inline mopo_float get(mopo_float past) const {
         double float_index;
         mopo_float sample_fraction = modf(past, &float_index);
         int index = std::max<int>(float_index, 1);
+        index = std::min<int>(index, bitmask_);
 
         // TODO(mtytel): Quadratic or all-pass interpolation is better.
         mopo_float from = getIndex(index - 1);
@@ -58,7 +77,8 @@ namespace mopo {
       }
 
     protected:
-      mopo_float memory_[MAX_MEMORY];
+      std::vector<mopo_float> memory_;
+      unsigned int bitmask_;
       unsigned int offset_;
   };
 } // namespace mopo
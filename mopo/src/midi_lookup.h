@@ -29,16 +29,10 @@
 
 namespace mopo {
 
+  // The frequency of every cent is generated at build time by
+  // generate_tables.cpp so the table is read only data.
   class MidiLookupSingleton {
     public:
-      MidiLookupSingleton() {
-        mopo_float cents_per_octave = CENTS_PER_NOTE * NOTES_PER_OCTAVE;
-        for (int i = 0; i <= MAX_CENTS; ++i) {
-          frequency_lookup_[i] = MIDI_0_FREQUENCY *
-                                 pow(2, i / cents_per_octave);
-        }
-      }
-
       mopo_float centsLookup(mopo_float cents_from_0) const {
         if (cents_from_0 >= MAX_CENTS)
           return frequency_lookup_[MAX_CENTS];
@@ -53,7 +47,7 @@ namespace mopo {
       }
 
     private:
-      mopo_float frequency_lookup_[MAX_CENTS + 1];
+      static const mopo_float frequency_lookup_[MAX_CENTS + 1];
   };
 
   class MidiLookup {
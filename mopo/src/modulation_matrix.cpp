@@ -0,0 +1,138 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "modulation_matrix.h"
+
+#include "processor_router.h"
+
+namespace mopo {
+
+  ModulationMatrix::ModulationMatrix(int num_slots) :
+      Processor(num_slots, 0), num_slots_(num_slots) {
+    routing_ = new Routing();
+    routing_->owner = this;
+    routing_->slot_sources.resize(num_slots, -1);
+    routing_->slot_destinations.resize(num_slots, -1);
+
+    // Slot changes rebuild the routes on the audio thread. With room for
+    // every slot reserved here, and no rewiring, that never allocates.
+    routing_->routes.reserve(num_slots);
+  }
+
+  ModulationMatrix::~ModulationMatrix() {
+    if (routing_->owner == this)
+      delete routing_;
+  }
+
+  void ModulationMatrix::process() {
+    int num_destinations = outputs_.size();
+    for (int i = 0; i < num_destinations; ++i)
+      outputs_[i]->clearBuffer();
+
+    const std::vector<Route>& routes = routing_->routes;
+    int num_routes = routes.size();
+    for (int r = 0; r < num_routes; ++r) {
+      const Output* scale = inputs_[routes[r].scale]->source;
+      const mopo_float* source = inputs_[routes[r].source]->source->buffer;
+      mopo_float* dest = outputs_[routes[r].destination]->buffer;
+
+      if (scale->constant) {
+        mopo_float amount = scale->buffer[0];
+        for (int i = 0; i < buffer_size_; ++i)
+          dest[i] += source[i] * amount;
+      }
+      else {
+        for (int i = 0; i < buffer_size_; ++i)
+          dest[i] += source[i] * scale->buffer[i];
+      }
+    }
+  }
+
+  bool ModulationMatrix::readsInput(int index) const {
+    return index < num_slots_ || routing_->used_sources[index - num_slots_];
+  }
+
+  int ModulationMatrix::addSource(const Output* source) {
+    Input* input = new Input();
+    input->owner = this;
+    input->source = &Processor::null_source_;
+    registerInput(input);
+    routing_->sources.push_back(source);
+    routing_->used_sources.push_back(false);
+
+    int index = routing_->sources.size() - 1;
+    plug(source, num_slots_ + index);
+    return index;
+  }
+
+  int ModulationMatrix::addDestination() {
+    Output* output = new Output();
+    output->owner = this;
+    registerOutput(output);
+    return outputs_.size() - 1;
+  }
+
+  void ModulationMatrix::setSlotSource(int slot, int source) {
+    MOPO_ASSERT(slot >= 0 && slot < num_slots_);
+    MOPO_ASSERT(source < static_cast<int>(routing_->sources.size()));
+    if (routing_->slot_sources[slot] == source)
+      return;
+
+    routing_->slot_sources[slot] = source;
+    updateRoutes();
+  }
+
+  void ModulationMatrix::setSlotDestination(int slot, int destination) {
+    MOPO_ASSERT(slot >= 0 && slot < num_slots_);
+    MOPO_ASSERT(destination < numOutputs());
+    if (routing_->slot_destinations[slot] == destination)
+      return;
+
+    routing_->slot_destinations[slot] = destination;
+    updateRoutes();
+  }
+
+  void ModulationMatrix::updateRoutes() {
+    std::vector<Route>& routes = routing_->routes;
+    routes.clear();
+
+    for (int slot = 0; slot < num_slots_; ++slot) {
+      int source = routing_->slot_sources[slot];
+      int destination = routing_->slot_destinations[slot];
+      if (source < 0 || destination < 0)
+        continue;
+
+      Route route = { slot, num_slots_ + source, destination };
+      routes.push_back(route);
+    }
+
+    std::vector<bool>& used = routing_->used_sources;
+    int num_sources = used.size();
+    int num_routes = routes.size();
+    bool changed = false;
+    for (int i = 0; i < num_sources; ++i) {
+      bool read = false;
+      for (int r = 0; r < num_routes; ++r)
+        read = read || routes[r].source == num_slots_ + i;
+
+      changed = changed || read != used[i];
+      used[i] = read;
+    }
+
+    if (changed && router_)
+      router_->inputsChanged();
+  }
+} // namespace mopo
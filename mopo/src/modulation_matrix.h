@@ -0,0 +1,86 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef MODULATION_MATRIX_H
+#define MODULATION_MATRIX_H
+
+#include "processor.h"
+
+#include <vector>
+
+namespace mopo {
+
+  // Routes modulation sources into destinations. Each slot scales one source
+  // and adds it into one destination. Only slots with both a source and a
+  // destination cost anything when processing. Every source is plugged in
+  // when it is added and never rewired. We tell our router when the sources
+  // some slot reads change so it can skip whatever computes the rest. The
+  // first _num_slots_ inputs are the slot scales.
+  class ModulationMatrix : public Processor {
+    public:
+      ModulationMatrix(int num_slots);
+      virtual ~ModulationMatrix();
+
+      virtual Processor* clone() const { return new ModulationMatrix(*this); }
+      virtual void process();
+      virtual bool readsInput(int index) const;
+
+      // Adds a source that slots can read and returns its index.
+      int addSource(const Output* source);
+
+      // Adds a destination and returns its index, which is also the index of
+      // the output that carries its sum.
+      int addDestination();
+
+      // Routes _slot_ from source index _source_ to destination index
+      // _destination_. Either one -1 turns the slot off.
+      void setSlotSource(int slot, int source);
+      void setSlotDestination(int slot, int destination);
+
+      int numSlots() const { return num_slots_; }
+
+    private:
+      // A slot with both ends set, as input and output indices.
+      struct Route {
+        int scale;
+        int source;
+        int destination;
+      };
+
+      // Rebuilds the active routes and tells our router if the sources they
+      // read changed.
+      void updateRoutes();
+
+      // The routing is shared with all copies, like their ports, and freed
+      // by its _owner_.
+      struct Routing {
+        const ModulationMatrix* owner;
+        std::vector<const Output*> sources;
+        std::vector<int> slot_sources;
+        std::vector<int> slot_destinations;
+        std::vector<Route> routes;
+
+        // Which sources some route reads, sized as sources are added.
+        std::vector<bool> used_sources;
+      };
+
+      Routing* routing_;
+      int num_slots_;
+  };
+} // namespace mopo
+
+#endif // MODULATION_MATRIX_H
@@ -41,7 +41,12 @@ namespace mopo {
   const int MIDI_SIZE = 128;
   const int PPQ = 15360; // Pulses per quarter note.
 
+  // Configure with --enable-float to process single precision samples.
+#ifdef MOPO_FLOAT
+  typedef float mopo_float;
+#else
   typedef double mopo_float;
+#endif
 
   // Common types of events across different Processors.
   enum VoiceEvent {
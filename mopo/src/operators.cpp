@@ -19,19 +19,111 @@
 namespace mopo {
 
   void Operator::process() {
+    if (inputsConstant()) {
+      tick(0);
+      fillConstant();
+      return;
+    }
+
+    processBlock();
+
+    int num_outputs = outputs_.size();
+    for (int i = 0; i < num_outputs; ++i)
+      outputs_[i]->constant = false;
+  }
+
+  void Operator::processBlock() {
     for (int i = 0; i < buffer_size_; ++i)
       tick(i);
   }
 
-  void VariableAdd::process() {
-    memset(outputs_[0]->buffer, 0, buffer_size_ * sizeof(mopo_float));
+  bool Operator::inputsConstant() const {
+    int num_inputs = inputs_.size();
+    for (int i = 0; i < num_inputs; ++i) {
+      if (!inputs_[i]->source->constant)
+        return false;
+    }
+    return true;
+  }
+
+  void Operator::fillConstant() {
+    int num_outputs = outputs_.size();
+    for (int i = 0; i < num_outputs; ++i) {
+      mopo_float* buffer = outputs_[i]->buffer;
+      for (int s = 1; s < buffer_size_; ++s)
+        buffer[s] = buffer[0];
+      outputs_[i]->constant = true;
+    }
+  }
+
+  void Clamp::processBlock() {
+    const mopo_float* source = inputs_[0]->source->buffer;
+    mopo_float* dest = outputs_[0]->buffer;
+    mopo_float min = min_;
+    mopo_float max = max_;
+    for (int i = 0; i < buffer_size_; ++i)
+      dest[i] = CLAMP(source[i], min, max);
+  }
+
+  void Negate::processBlock() {
+    const mopo_float* source = inputs_[0]->source->buffer;
+    mopo_float* dest = outputs_[0]->buffer;
+    for (int i = 0; i < buffer_size_; ++i)
+      dest[i] = -source[i];
+  }
+
+  void LinearScale::processBlock() {
+    const mopo_float* source = inputs_[0]->source->buffer;
+    mopo_float* dest = outputs_[0]->buffer;
+    mopo_float scale = scale_;
+    for (int i = 0; i < buffer_size_; ++i)
+      dest[i] = scale * source[i];
+  }
+
+  void Add::processBlock() {
+    const mopo_float* left = inputs_[0]->source->buffer;
+    const mopo_float* right = inputs_[1]->source->buffer;
+    mopo_float* dest = outputs_[0]->buffer;
+    for (int i = 0; i < buffer_size_; ++i)
+      dest[i] = left[i] + right[i];
+  }
+
+  void VariableAdd::processBlock() {
+    mopo_float* dest = outputs_[0]->buffer;
+    memset(dest, 0, buffer_size_ * sizeof(mopo_float));
 
     int num_inputs = inputs_.size();
     for (int i = 0; i < num_inputs; ++i) {
       if (inputs_[i]->source != &Processor::null_source_) {
+        const mopo_float* source = inputs_[i]->source->buffer;
         for (int s = 0; s < buffer_size_; ++s)
-          outputs_[0]->buffer[s] += inputs_[i]->at(s);
+          dest[s] += source[s];
       }
     }
   }
+
+  void Subtract::processBlock() {
+    const mopo_float* left = inputs_[0]->source->buffer;
+    const mopo_float* right = inputs_[1]->source->buffer;
+    mopo_float* dest = outputs_[0]->buffer;
+    for (int i = 0; i < buffer_size_; ++i)
+      dest[i] = left[i] - right[i];
+  }
+
+  void Multiply::processBlock() {
+    const mopo_float* left = inputs_[0]->source->buffer;
+    const mopo_float* right = inputs_[1]->source->buffer;
+    mopo_float* dest = outputs_[0]->buffer;
+    for (int i = 0; i < buffer_size_; ++i)
+      dest[i] = left[i] * right[i];
+  }
+
+  void Interpolate::processBlock() {
+    const mopo_float* from = inputs_[kFrom]->source->buffer;
+    const mopo_float* to = inputs_[kTo]->source->buffer;
+    const mopo_float* fractional = inputs_[kFractional]->source->buffer;
+    mopo_float* dest = outputs_[0]->buffer;
+    for (int i = 0; i < buffer_size_; ++i)
+      dest[i] = INTERPOLATE(from[i], to[i], fractional[i]);
+  }
 } // namespace mopo
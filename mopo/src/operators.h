@@ -23,7 +23,9 @@
 
 namespace mopo {
 
-  // A base class for arithmetic operators.
+  // A base class for arithmetic operators. When all the inputs are constant
+  // for a buffer we only compute the first sample and mark the outputs
+  // constant too. _tick_ is for TickRouters that run sample by sample.
   class Operator : public Processor {
     public:
       Operator(int num_inputs, int num_outputs) :
@@ -31,6 +33,17 @@ namespace mopo {
 
       virtual void process();
       virtual void tick(int i) = 0;
+
+      // Computes the whole buffer. Subclasses override this with a loop over
+      // the raw buffers that the compiler can vectorize. The default calls
+      // _tick_ for every sample.
+      virtual void processBlock();
+
+    protected:
+      bool inputsConstant() const;
+
+      // Copies the first sample of every output through the buffer.
+      void fillConstant();
   };
 
   // A processor that will clamp a signal output to a given window.
@@ -41,6 +54,8 @@ namespace mopo {
 
       virtual Processor* clone() const { return new Clamp(*this); }
 
+      virtual void processBlock();
+
       inline void tick(int i) {
         outputs_[0]->buffer[i] = CLAMP(inputs_[0]->at(i), min_, max_);
       }
@@ -56,6 +71,8 @@ namespace mopo {
 
       virtual Processor* clone() const { return new Negate(*this); }
 
+      virtual void processBlock();
+
       inline void tick(int i) {
         outputs_[0]->buffer[i] = -inputs_[0]->at(i);
       }
@@ -67,6 +84,8 @@ namespace mopo {
       LinearScale(mopo_float scale = 1) : Operator(1, 1), scale_(scale) { }
       virtual Processor* clone() const { return new LinearScale(*this); }
 
+      virtual void processBlock();
+
       inline void tick(int i) {
         outputs_[0]->buffer[i] = scale_ * inputs_[0]->at(i);
       }
@@ -95,6 +114,8 @@ namespace mopo {
 
       virtual Processor* clone() const { return new Add(*this); }
 
+      virtual void processBlock();
+
       inline void tick(int i) {
         outputs_[0]->buffer[i] = inputs_[0]->at(i) + inputs_[1]->at(i);
       }
@@ -107,7 +128,8 @@ namespace mopo {
 
       virtual Processor* clone() const { return new VariableAdd(*this); }
 
-      void process();
+      virtual void processBlock();
+
       inline void tick(int i) {
         int num_inputs = inputs_.size();
         outputs_[0]->buffer[i] = 0.0;
@@ -123,6 +145,8 @@ namespace mopo {
 
       virtual Processor* clone() const { return new Subtract(*this); }
 
+      virtual void processBlock();
+
       inline void tick(int i) {
         outputs_[0]->buffer[i] = inputs_[0]->at(i) - inputs_[1]->at(i);
       }
@@ -135,6 +159,8 @@ namespace mopo {
 
       virtual Processor* clone() const { return new Multiply(*this); }
 
+      virtual void processBlock();
+
       inline void tick(int i) {
         outputs_[0]->buffer[i] = inputs_[0]->at(i) * inputs_[1]->at(i);
       }
@@ -154,6 +180,8 @@ namespace mopo {
 
       virtual Processor* clone() const { return new Interpolate(*this); }
 
+      virtual void processBlock();
+
       inline void tick(int i) {
         outputs_[0]->buffer[i] = INTERPOLATE(inputs_[kFrom]->at(i),
                                              inputs_[kTo]->at(i),
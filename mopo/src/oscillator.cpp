@@ -20,11 +20,78 @@
 
 namespace mopo {
 
+  unsigned int Oscillator::next_random_seed_ = 1;
+
   Oscillator::Oscillator() : Processor(kNumInputs, 1),
-                             offset_(0.0), waveform_(Wave::kSin) { }
+                             phase_(0), phase_increment_(0),
+                             frequency_(0.0), harmonics_(-1),
+                             waveform_(Wave::kSin),
+                             kernel_(&Oscillator::processWave<Wave::kSin>),
+                             random_seed_(nextRandomSeed()) { }
+
+  Oscillator::Oscillator(const Oscillator& original) :
+      Processor(original), phase_(original.phase_),
+      phase_increment_(original.phase_increment_),
+      frequency_(original.frequency_), harmonics_(original.harmonics_),
+      waveform_(original.waveform_), kernel_(original.kernel_),
+      random_seed_(nextRandomSeed()) { }
+
+  unsigned int Oscillator::nextRandomSeed() {
+    return __atomic_fetch_add(&next_random_seed_, 1, __ATOMIC_RELAXED);
+  }
+
+  void Oscillator::setSampleRate(int sample_rate) {
+    Processor::setSampleRate(sample_rate);
+    phase_increment_ = toPhase(frequency_ / sample_rate_);
+  }
 
   void Oscillator::preprocess() {
-    waveform_ = static_cast<Wave::Type>(inputs_[kWaveform]->at(0));
+    Wave::Type waveform =
+        static_cast<Wave::Type>(inputs_[kWaveform]->at(0));
+    if (waveform == waveform_)
+      return;
+
+    waveform_ = waveform;
+    switch (waveform_) {
+      case Wave::kSin:
+        kernel_ = &Oscillator::processWave<Wave::kSin>;
+        break;
+      case Wave::kTriangle:
+        kernel_ = &Oscillator::processWave<Wave::kTriangle>;
+        break;
+      case Wave::kSquare:
+        kernel_ = &Oscillator::processWave<Wave::kSquare>;
+        break;
+      case Wave::kDownSaw:
+        kernel_ = &Oscillator::processWave<Wave::kDownSaw>;
+        break;
+      case Wave::kUpSaw:
+        kernel_ = &Oscillator::processWave<Wave::kUpSaw>;
+        break;
+      case Wave::kThreeStep:
+        kernel_ = &Oscillator::processWave<Wave::kThreeStep>;
+        break;
+      case Wave::kFourStep:
+        kernel_ = &Oscillator::processWave<Wave::kFourStep>;
+        break;
+      case Wave::kEightStep:
+        kernel_ = &Oscillator::processWave<Wave::kEightStep>;
+        break;
+      case Wave::kThreePyramid:
+        kernel_ = &Oscillator::processWave<Wave::kThreePyramid>;
+        break;
+      case Wave::kFivePyramid:
+        kernel_ = &Oscillator::processWave<Wave::kFivePyramid>;
+        break;
+      case Wave::kNinePyramid:
+        kernel_ = &Oscillator::processWave<Wave::kNinePyramid>;
+        break;
+      case Wave::kWhiteNoise:
+        kernel_ = &Oscillator::processWave<Wave::kWhiteNoise>;
+        break;
+      default:
+        kernel_ = &Oscillator::processWave<Wave::kNumWaveforms>;
+    }
   }
 
   void Oscillator::process() {
@@ -33,13 +100,41 @@ namespace mopo {
     int i = 0;
     if (inputs_[kReset]->source->triggered &&
         inputs_[kReset]->source->trigger_value == kVoiceReset) {
-      int trigger_offset = inputs_[kReset]->source->trigger_offset;
-      for (; i < trigger_offset; ++i)
-        tick(i);
+      i = inputs_[kReset]->source->trigger_offset;
+      (this->*kernel_)(0, i);
+      phase_ = 0;
+    }
+    (this->*kernel_)(i, buffer_size_);
+  }
+
+  template<Wave::Type waveform>
+  void Oscillator::processWave(int start, int end) {
+    const mopo_float* frequency = inputs_[kFrequency]->source->buffer;
+    const Output* phase_source = inputs_[kPhase]->source;
+    mopo_float* dest = outputs_[0]->buffer;
+
+    // Unplugged or constant phase inputs convert once.
+    bool constant_phase = phase_source->constant;
+    mopo_phase phase_offset = toPhase(phase_source->buffer[0]);
 
-      offset_ = 0.0;
+    for (int i = start; i < end; ++i) {
+      if (frequency[i] != frequency_)
+        setFrequency(frequency[i]);
+      phase_ += phase_increment_;
+
+      if (waveform == Wave::kWhiteNoise)
+        dest[i] = Wave::whitenoise(&random_seed_);
+      else {
+        if (!constant_phase)
+          phase_offset = toPhase(phase_source->buffer[i]);
+        dest[i] = Wave::blwave<waveform>(phase_ + phase_offset, harmonics_);
+      }
     }
-    for (; i < buffer_size_; ++i)
-      tick(i);
+  }
+
+  void Oscillator::setFrequency(mopo_float frequency) {
+    frequency_ = frequency;
+    phase_increment_ = toPhase(frequency / sample_rate_);
+    harmonics_ = Wave::harmonics(frequency);
   }
 } // namespace mopo
@@ -37,25 +37,46 @@ namespace mopo {
       };
 
       Oscillator();
+      Oscillator(const Oscillator& original);
 
       virtual Processor* clone() const { return new Oscillator(*this); }
+      virtual void setSampleRate(int sample_rate);
+
+      // Prepares the current waveform and picks its kernel. process() does
+      // this itself, call it before ticking a block.
       void preprocess();
       void process();
 
       inline void tick(int i) {
-        mopo_float frequency = inputs_[kFrequency]->at(i);
-        mopo_float phase = inputs_[kPhase]->at(i);
-
-        offset_ += frequency / sample_rate_;
-        double integral;
-        offset_ = modf(offset_, &integral);
-        outputs_[0]->buffer[i] =
-            Wave::blwave(waveform_, offset_ + phase, frequency);
+        (this->*kernel_)(i, i + 1);
       }
 
     protected:
-      mopo_float offset_;
+      // Produces samples [_start_, _end_) of one waveform.
+      typedef void (Oscillator::*Kernel)(int start, int end);
+
+      template<Wave::Type waveform>
+      void processWave(int start, int end);
+
+      // Only called when the frequency input changes.
+      void setFrequency(mopo_float frequency);
+
+      // The phase is fixed point so it wraps by itself and is just as exact
+      // in float builds. The increment and harmonics follow _frequency_.
+      mopo_phase phase_;
+      mopo_phase phase_increment_;
+      mopo_float frequency_;
+      int harmonics_;
       Wave::Type waveform_;
+      Kernel kernel_;
+
+      // Every oscillator has its own noise generator so voices don't depend
+      // on the order other voices are processed in. Voices are copied on
+      // whichever thread creates them, so seeds are handed out atomically.
+      static unsigned int nextRandomSeed();
+
+      unsigned int random_seed_;
+      static unsigned int next_random_seed_;
   };
 } // namespace mopo
 
@@ -18,15 +18,49 @@
 
 #include "processor_router.h"
 
+#include <algorithm>
+#include <cmath>
+
 namespace mopo {
 
-  const Processor::Output Processor::null_source_;
+  // Unplugged inputs read silence, which never changes.
+  const Processor::Output Processor::null_source_(MAX_BUFFER_SIZE, true);
+
+  void Processor::Output::resizeBuffer(int size) {
+    if (own_buffer_ && size == buffer_size)
+      return;
+
+    mopo_float* resized = new mopo_float[size];
+    int keep = buffer ? std::min(size, buffer_size) : 0;
+    if (keep)
+      memcpy(resized, buffer, keep * sizeof(mopo_float));
+    memset(resized + keep, 0, (size - keep) * sizeof(mopo_float));
+    if (keep < size)
+      constant = false;
+
+    delete[] own_buffer_;
+    own_buffer_ = resized;
+    buffer = resized;
+    buffer_size = size;
+  }
+
+  void Processor::Output::borrowBuffer(mopo_float* pooled, int size) {
+    delete[] own_buffer_;
+    own_buffer_ = 0;
+    buffer = pooled;
+    buffer_size = size;
+  }
 
   Processor::Processor(int num_inputs, int num_outputs) :
       sample_rate_(DEFAULT_SAMPLE_RATE), buffer_size_(DEFAULT_BUFFER_SIZE),
       router_(0) {
+#ifdef MOPO_COUNT_DENORMALS
+    subnormals_ = 0;
+#endif
+
     for (int i = 0; i < num_inputs; ++i) {
       Input* input = new Input();
+      input->owner = this;
 
       // All inputs start off with null input.
       input->source = &Processor::null_source_;
@@ -42,6 +76,75 @@ namespace mopo {
     }
   }
 
+  Processor::~Processor() {
+    for (size_t i = 0; i < inputs_.size(); ++i) {
+      if (inputs_[i]->owner == this)
+        delete inputs_[i];
+    }
+
+    for (size_t i = 0; i < outputs_.size(); ++i) {
+      if (outputs_[i]->owner == this)
+        delete outputs_[i];
+    }
+  }
+
+  void Processor::processBank(Processor* const* bank, int bank_size) {
+    for (int i = 0; i < bank_size; ++i)
+      bank[i]->process();
+  }
+
+#ifdef MOPO_COUNT_DENORMALS
+  void Processor::countSubnormals() {
+    int num_outputs = outputs_.size();
+    for (int o = 0; o < num_outputs; ++o) {
+      const mopo_float* buffer = outputs_[o]->buffer;
+      int size = std::min(outputs_[o]->buffer_size, buffer_size_);
+      for (int i = 0; i < size; ++i) {
+        if (std::fpclassify(buffer[i]) == FP_SUBNORMAL)
+          subnormals_++;
+      }
+    }
+  }
+#endif
+
+  void Processor::setBufferSize(int buffer_size) {
+    buffer_size_ = buffer_size;
+
+    // Outputs that borrow pooled buffers get them reassigned by their router.
+    for (size_t i = 0; i < outputs_.size(); ++i) {
+      if (outputs_[i]->buffer_size != buffer_size)
+        outputs_[i]->resizeBuffer(buffer_size);
+    }
+  }
+
+  void Processor::localize(Localization* localization) {
+    for (size_t i = 0; i < outputs_.size(); ++i) {
+      Output* output = new Output(outputs_[i]->buffer_size,
+                                  outputs_[i]->constant);
+      output->owner = this;
+      memcpy(output->buffer, outputs_[i]->buffer,
+             output->buffer_size * sizeof(mopo_float));
+      localization->outputs[outputs_[i]] = output;
+      outputs_[i] = output;
+    }
+
+    for (size_t i = 0; i < inputs_.size(); ++i) {
+      Input* input = new Input();
+      input->owner = this;
+      input->source = inputs_[i]->source;
+      localization->inputs[inputs_[i]] = input;
+      inputs_[i] = input;
+    }
+  }
+
+  void Processor::relink(const Processor* original,
+                         const Localization* localization) {
+    MOPO_ASSERT(original->numInputs() == numInputs());
+
+    for (size_t i = 0; i < inputs_.size(); ++i)
+      inputs_[i]->source = localization->local(original->input(i)->source);
+  }
+
   void Processor::plug(const Output* source) {
     plug(source, 0);
   }
@@ -79,6 +182,9 @@ namespace mopo {
 
   void Processor::unplugIndex(unsigned int input_index) {
     inputs_[input_index]->source = &Processor::null_source_;
+
+    if (router_)
+      router_->disconnect(this);
   }
 
   void Processor::unplug(const Output* source) {
@@ -86,6 +192,9 @@ namespace mopo {
       if (inputs_[i]->source == source)
         inputs_[i]->source = &Processor::null_source_;
     }
+
+    if (router_)
+      router_->disconnect(this);
   }
 
   void Processor::unplug(const Processor* source) {
@@ -93,6 +202,9 @@ namespace mopo {
       if (inputs_[i]->source->owner == source)
         inputs_[i]->source = &Processor::null_source_;
     }
+
+    if (router_)
+      router_->disconnect(this);
   }
 
   void Processor::registerInput(Input* input) {
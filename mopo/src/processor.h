@@ -21,6 +21,7 @@
 #include "mopo.h"
 
 #include <cstring>
+#include <map>
 #include <vector>
 
 namespace mopo {
@@ -31,12 +32,18 @@ namespace mopo {
     public:
       // An output port from the Processor.
       struct Output {
-        Output() {
+        Output(int size = MAX_BUFFER_SIZE, bool is_constant = false) {
           owner = 0;
-          clearBuffer();
+          buffer = 0;
+          buffer_size = 0;
+          own_buffer_ = 0;
+          resizeBuffer(size);
+          constant = is_constant;
           clearTrigger();
         }
 
+        ~Output() { delete[] own_buffer_; }
+
         void trigger(mopo_float value, int offset = 0) {
           triggered = true;
           trigger_offset = offset;
@@ -50,29 +57,72 @@ namespace mopo {
         }
 
         void clearBuffer() {
-          memset(buffer, 0, MAX_BUFFER_SIZE * sizeof(mopo_float));
+          memset(buffer, 0, buffer_size * sizeof(mopo_float));
         }
 
+        // Gives the output its own buffer of _size_ samples, keeping the
+        // samples of the current buffer that fit and zeroing the rest.
+        void resizeBuffer(int size);
+
+        // Uses _pooled_, which the output doesn't own, as its buffer. See
+        // ProcessorRouter::poolBuffers.
+        void borrowBuffer(mopo_float* pooled, int size);
+
         const Processor* owner;
-        mopo_float buffer[MAX_BUFFER_SIZE];
+        mopo_float* buffer;
+        int buffer_size;
+
+        // Set if every sample of _buffer_ holds the same value for this
+        // buffer. Readers can then compute with the first sample only.
+        // Processors that don't keep this up to date leave it false.
+        bool constant;
 
         bool triggered;
         int trigger_offset;
         mopo_float trigger_value;
+
+      private:
+        mopo_float* own_buffer_;
+
+        // Outputs are shared by pointer, never copied.
+        Output(const Output&);
+        Output& operator=(const Output&);
       };
 
       // An input port to the Processor. You can plug an Output into on of
       // these inputs.
       struct Input {
-        Input() { source = 0; }
+        Input() {
+          owner = 0;
+          source = 0;
+        }
 
+        const Processor* owner;
         const Output* source;
 
         mopo_float at(int i) const { return source->buffer[i]; }
       };
 
+      // Maps the Inputs and Outputs a copy of a Processor shares with its
+      // original to the copy's own ports. See _localize_.
+      struct Localization {
+        std::map<const Output*, Output*> outputs;
+        std::map<const Input*, Input*> inputs;
+
+        // Returns the local version of _shared_ or _shared_ if there is none.
+        const Output* local(const Output* shared) const {
+          std::map<const Output*, Output*>::const_iterator found =
+              outputs.find(shared);
+          return found == outputs.end() ? shared : found->second;
+        }
+      };
+
       Processor(int num_inputs, int num_outputs);
 
+      // Frees the ports this Processor created. Copies that still share
+      // their original's ports leave them to the original.
+      virtual ~Processor();
+
       // Currently need to override this boiler plate clone.
       // TODO(mtytel): Should probably make a macro for this.
       virtual Processor* clone() const = 0;
@@ -80,16 +130,67 @@ namespace mopo {
       // Subclasses override this for main processing code.
       virtual void process() = 0;
 
+      // Processes _bank_size_ localized copies of the same Processor, _this_
+      // being the first. Subclasses can override this to run all copies in
+      // one kernel. The default processes them one at a time.
+      virtual void processBank(Processor* const* bank, int bank_size);
+
+#ifdef MOPO_COUNT_DENORMALS
+      // Configure with --enable-denormal-counter to count the subnormal
+      // samples each processor outputs.
+      typedef std::map<const Processor*, unsigned long long> SubnormalCounts;
+
+      // Adds the subnormal samples in the outputs to the count. Routers call
+      // this each time they process the processor.
+      void countSubnormals();
+      unsigned long long subnormals() const { return subnormals_; }
+
+      // Adds what this and the processors inside it counted to _counts_,
+      // counting this one as _key_. Copies count as their original so all
+      // the voices of a VoiceHandler add up.
+      virtual void collectSubnormals(const Processor* key,
+                                     SubnormalCounts* counts) const {
+        (*counts)[key] += subnormals_;
+      }
+#endif
+
       // Subclasses should override this if they need to adjust for change in
       // sample rate.
       virtual void setSampleRate(int sample_rate) {
         sample_rate_ = sample_rate;
       }
 
-      virtual void setBufferSize(int buffer_size) {
-        buffer_size_ = buffer_size;
+      // Outputs are resized to match _buffer_size_.
+      virtual void setBufferSize(int buffer_size);
+
+      // Returns true if process() writes the whole buffer of every output each
+      // time it runs. Only outputs that are rewritten can borrow buffers from
+      // a pool that other outputs also use.
+      virtual bool rewritesOutputs() const { return true; }
+
+      // Returns false while process() ignores input _index_. Routers skip the
+      // processors that only feed inputs nobody reads. Tell our router with
+      // ProcessorRouter::inputsChanged whenever the answer changes.
+      virtual bool readsInput(int index) const {
+        UNUSED(index);
+        return true;
       }
 
+      // Returns true if process() has to run every buffer even while nothing
+      // reads our outputs, e.g. to follow note triggers. Routers that skip
+      // unused processors never skip these.
+      virtual bool alwaysActive() const { return false; }
+
+      // Copies share their Inputs and Outputs with their original. This gives
+      // the copy its own ports, recording them in _localization_, so it can be
+      // processed at the same time as other copies.
+      virtual void localize(Localization* localization);
+
+      // Points the inputs of a localized copy at the local versions of the
+      // sources that _original_ is plugged into.
+      virtual void relink(const Processor* original,
+                          const Localization* localization);
+
       // Attaches an output to an input in this processor.
       void plug(const Output* source);
       void plug(const Output* source, unsigned int input_index);
@@ -132,6 +233,10 @@ namespace mopo {
 
       ProcessorRouter* router_;
 
+#ifdef MOPO_COUNT_DENORMALS
+      unsigned long long subnormals_;
+#endif
+
       static const Output null_source_;
   };
 } // namespace mopo
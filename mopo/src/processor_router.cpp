@@ -25,14 +25,25 @@
 namespace mopo {
 
   ProcessorRouter::ProcessorRouter(int num_inputs, int num_outputs) :
-      Processor(num_inputs, num_outputs) {
+      Processor(num_inputs, num_outputs), local_changes_(0),
+      local_input_changes_(0), owns_graph_(true), localization_(0), pool_buffers_(false),
+      pool_buffer_size_(0) {
     order_ = new std::vector<const Processor*>();
     feedback_order_ = new std::vector<const Feedback*>();
+    global_changes_ = new int(0);
+    active_ = new ActiveProcessors();
+    active_->changes = -1;
+    active_->input_changes = 0;
+    active_->active_input_changes = -1;
   }
 
   ProcessorRouter::ProcessorRouter(const ProcessorRouter& original) :
       Processor(original), order_(original.order_),
-      feedback_order_(original.feedback_order_) {
+      feedback_order_(original.feedback_order_), active_(original.active_),
+      global_changes_(original.global_changes_), local_changes_(-1),
+      local_input_changes_(-1),
+      owns_graph_(false), localization_(0), pool_buffers_(false),
+      pool_buffer_size_(0) {
     size_t num_processors = order_->size();
     for (size_t i = 0; i < num_processors; ++i) {
       const Processor* next = order_->at(i);
@@ -44,52 +55,277 @@ namespace mopo {
       const Feedback* next = feedback_order_->at(i);
       feedback_processors_[next] = new Feedback(*next);
     }
+
+    updateAllProcessors();
+  }
+
+  ProcessorRouter::~ProcessorRouter() {
+    // Most of our registered ports belong to the processors freed below so
+    // sort ours out while they can still be told apart.
+    for (size_t i = 0; i < inputs_.size(); ++i) {
+      if (inputs_[i]->owner == this)
+        delete inputs_[i];
+    }
+    for (size_t i = 0; i < outputs_.size(); ++i) {
+      if (outputs_[i]->owner == this)
+        delete outputs_[i];
+    }
+    inputs_.clear();
+    outputs_.clear();
+
+    std::map<const Processor*, Processor*>::iterator iter;
+    for (iter = processors_.begin(); iter != processors_.end(); ++iter)
+      delete iter->second;
+
+    std::map<const Feedback*, Feedback*>::iterator feedback;
+    for (feedback = feedback_processors_.begin();
+         feedback != feedback_processors_.end(); ++feedback) {
+      delete feedback->second;
+    }
+
+    for (size_t i = 0; i < buffer_pool_.size(); ++i)
+      delete[] buffer_pool_[i];
+
+    if (owns_graph_) {
+      delete order_;
+      delete feedback_order_;
+      delete active_;
+      delete global_changes_;
+    }
   }
 
   void ProcessorRouter::process() {
-    updateAllProcessors();
+    update();
 
     // First make sure all the Feedback loops are ready to be read.
-    int num_feedbacks = feedback_order_->size();
+    int num_feedbacks = compiled_feedback_order_.size();
     for (int i = 0; i < num_feedbacks; ++i)
-      feedback_processors_[feedback_order_->at(i)]->refreshOutput();
+      compiled_feedback_order_[i]->refreshOutput();
 
     // Run all the main processors.
-    int num_processors = order_->size();
-    for (int i = 0; i < num_processors; ++i)
-      processors_[order_->at(i)]->process();
+    int num_processors = active_order_.size();
+    for (int i = 0; i < num_processors; ++i) {
+      active_order_[i]->process();
+#ifdef MOPO_COUNT_DENORMALS
+      active_order_[i]->countSubnormals();
+#endif
+    }
 
     // Store the outputs into the Feedback objects for next time.
     for (int i = 0; i < num_feedbacks; ++i)
-      feedback_processors_[feedback_order_->at(i)]->process();
+      compiled_feedback_order_[i]->process();
 
     MOPO_ASSERT(num_processors != 0);
   }
 
+  void ProcessorRouter::processLockstep(ProcessorRouter* const* copies,
+                                        int num_copies) {
+    if (num_copies <= 0)
+      return;
+
+    for (int c = 0; c < num_copies; ++c) {
+      MOPO_ASSERT(copies[c]->order_ == order_ && copies[c]->localization_);
+      copies[c]->update();
+    }
+
+    prepareLockstep(num_copies);
+
+    int num_feedbacks = feedback_order_->size();
+    for (int i = 0; i < num_feedbacks; ++i) {
+      for (int c = 0; c < num_copies; ++c)
+        copies[c]->compiled_feedback_order_[i]->refreshOutput();
+    }
+
+    // The copies share which processors are active so their orders line up.
+    int num_processors = copies[0]->active_order_.size();
+    for (int i = 0; i < num_processors; ++i) {
+      for (int c = 0; c < num_copies; ++c)
+        lockstep_bank_[c] = copies[c]->active_order_[i];
+      lockstep_bank_[0]->processBank(&lockstep_bank_[0], num_copies);
+#ifdef MOPO_COUNT_DENORMALS
+      for (int c = 0; c < num_copies; ++c)
+        lockstep_bank_[c]->countSubnormals();
+#endif
+    }
+
+    for (int i = 0; i < num_feedbacks; ++i) {
+      for (int c = 0; c < num_copies; ++c)
+        copies[c]->compiled_feedback_order_[i]->process();
+    }
+  }
+
+  void ProcessorRouter::prepareLockstep(int num_copies) {
+    if (lockstep_bank_.size() < static_cast<size_t>(num_copies))
+      lockstep_bank_.resize(num_copies);
+  }
+
   void ProcessorRouter::setSampleRate(int sample_rate) {
     Processor::setSampleRate(sample_rate);
     updateAllProcessors();
 
-    int num_processors = order_->size();
+    int num_processors = compiled_order_.size();
     for (int i = 0; i < num_processors; ++i)
-      processors_[order_->at(i)]->setSampleRate(sample_rate);
+      compiled_order_[i]->setSampleRate(sample_rate);
 
-    int num_feedbacks = feedback_order_->size();
+    int num_feedbacks = compiled_feedback_order_.size();
     for (int i = 0; i < num_feedbacks; ++i)
-      feedback_processors_[feedback_order_->at(i)]->setSampleRate(sample_rate);
+      compiled_feedback_order_[i]->setSampleRate(sample_rate);
   }
 
   void ProcessorRouter::setBufferSize(int buffer_size) {
     Processor::setBufferSize(buffer_size);
     updateAllProcessors();
 
-    int num_processors = order_->size();
+    int num_processors = compiled_order_.size();
     for (int i = 0; i < num_processors; ++i)
-      processors_[order_->at(i)]->setBufferSize(buffer_size);
+      compiled_order_[i]->setBufferSize(buffer_size);
 
-    int num_feedbacks = feedback_order_->size();
+    int num_feedbacks = compiled_feedback_order_.size();
+    for (int i = 0; i < num_feedbacks; ++i)
+      compiled_feedback_order_[i]->setBufferSize(buffer_size);
+
+    // Resizing gave every output its own buffer again.
+    if (pool_buffers_)
+      assignBuffers();
+  }
+
+  void ProcessorRouter::localize(Localization* localization) {
+    if (needsUpdate())
+      updateAllProcessors();
+
+    int num_processors = compiled_order_.size();
+    for (int i = 0; i < num_processors; ++i)
+      compiled_order_[i]->localize(localization);
+
+    int num_feedbacks = compiled_feedback_order_.size();
     for (int i = 0; i < num_feedbacks; ++i)
-      feedback_processors_[feedback_order_->at(i)]->setBufferSize(buffer_size);
+      compiled_feedback_order_[i]->localize(localization);
+
+    // Our registered ports belong to processors inside this router so they
+    // were just localized.
+    for (size_t i = 0; i < outputs_.size(); ++i) {
+      if (localization->outputs.count(outputs_[i]))
+        outputs_[i] = localization->outputs[outputs_[i]];
+    }
+
+    for (size_t i = 0; i < inputs_.size(); ++i) {
+      if (localization->inputs.count(inputs_[i]))
+        inputs_[i] = localization->inputs[inputs_[i]];
+    }
+
+    localization_ = localization;
+  }
+
+  void ProcessorRouter::relink(const Processor* original,
+                               const Localization* localization) {
+    UNUSED(original);
+    if (needsUpdate())
+      updateAllProcessors();
+
+    int num_processors = compiled_order_.size();
+    for (int i = 0; i < num_processors; ++i)
+      compiled_order_[i]->relink(order_->at(i), localization);
+
+    int num_feedbacks = compiled_feedback_order_.size();
+    for (int i = 0; i < num_feedbacks; ++i)
+      compiled_feedback_order_[i]->relink(feedback_order_->at(i), localization);
+  }
+
+#ifdef MOPO_COUNT_DENORMALS
+  void ProcessorRouter::collectSubnormals(const Processor* key,
+                                          SubnormalCounts* counts) const {
+    Processor::collectSubnormals(key, counts);
+
+    std::map<const Processor*, Processor*>::const_iterator iter;
+    for (iter = processors_.begin(); iter != processors_.end(); ++iter)
+      iter->second->collectSubnormals(iter->first, counts);
+  }
+#endif
+
+  void ProcessorRouter::poolBuffers(const std::set<const Output*>& pinned) {
+    MOPO_ASSERT(localization_);
+    pool_buffers_ = true;
+    pinned_outputs_ = pinned;
+    assignBuffers();
+  }
+
+  void ProcessorRouter::assignBuffers() {
+    // Old buffers may still be copied from below so free them at the end.
+    std::vector<mopo_float*> stale_buffers;
+    if (pool_buffer_size_ != buffer_size_) {
+      stale_buffers.swap(buffer_pool_);
+      pool_buffer_size_ = buffer_size_;
+    }
+
+    // Outputs read by our feedbacks or by whoever reads our registered
+    // outputs are needed after the whole order has run.
+    std::set<const Output*> pinned = pinned_outputs_;
+    pinned.insert(outputs_.begin(), outputs_.end());
+    int num_feedbacks = compiled_feedback_order_.size();
+    for (int i = 0; i < num_feedbacks; ++i)
+      pinned.insert(compiled_feedback_order_[i]->input()->source);
+
+    // Find the last processor in the order that reads each output. We can't
+    // see what the processors inside a nested router read, so everything
+    // written before a nested router has to survive until it has run. This
+    // covers skipped processors too so processors can start and stop being
+    // skipped without lending out buffers again.
+    int num_processors = compiled_order_.size();
+    std::map<const Output*, int> last_read;
+    std::vector<const Output*> written;
+    for (int i = 0; i < num_processors; ++i) {
+      Processor* processor = compiled_order_[i];
+      for (int j = 0; j < processor->numInputs(); ++j)
+        last_read[processor->input(j)->source] = i;
+
+      if (dynamic_cast<ProcessorRouter*>(processor)) {
+        for (size_t w = 0; w < written.size(); ++w)
+          last_read[written[w]] = i;
+      }
+
+      for (int j = 0; j < processor->numOutputs(); ++j)
+        written.push_back(processor->output(j));
+    }
+
+    // Walk the order lending out buffers and taking them back once an
+    // output's last reader has run.
+    std::vector<mopo_float*> free_buffers;
+    std::vector<std::vector<Output*> > returns(num_processors);
+    std::map<const Output*, mopo_float*> lent;
+    size_t num_used = 0;
+    for (int i = 0; i < num_processors; ++i) {
+      Processor* processor = compiled_order_[i];
+      for (int j = 0; j < processor->numOutputs(); ++j) {
+        Output* output = processor->output(j);
+        if (!processor->rewritesOutputs() || pinned.count(output)) {
+          output->resizeBuffer(buffer_size_);
+          continue;
+        }
+
+        mopo_float* buffer = 0;
+        if (free_buffers.size()) {
+          buffer = free_buffers.back();
+          free_buffers.pop_back();
+        }
+        else {
+          if (num_used == buffer_pool_.size())
+            buffer_pool_.push_back(new mopo_float[buffer_size_]);
+          buffer = buffer_pool_[num_used++];
+        }
+
+        output->borrowBuffer(buffer, buffer_size_);
+        lent[output] = buffer;
+        std::map<const Output*, int>::iterator read = last_read.find(output);
+        int last = read == last_read.end() ? i : std::max(i, read->second);
+        returns[last].push_back(output);
+      }
+
+      for (size_t r = 0; r < returns[i].size(); ++r)
+        free_buffers.push_back(lent[returns[i][r]]);
+    }
+
+    for (size_t i = 0; i < stale_buffers.size(); ++i)
+      delete[] stale_buffers[i];
   }
 
   void ProcessorRouter::addProcessor(Processor* processor) {
@@ -97,6 +333,7 @@ namespace mopo {
     processor->router(this);
     order_->push_back(processor);
     processors_[processor] = processor;
+    (*global_changes_)++;
 
     for (int i = 0; i < processor->numInputs(); ++i)
       connect(processor, processor->input(i)->source, i);
@@ -109,6 +346,12 @@ namespace mopo {
     MOPO_ASSERT(pos != order_->end());
     order_->erase(pos, pos + 1);
     processors_.erase(processor);
+    (*global_changes_)++;
+  }
+
+  void ProcessorRouter::requireOutput(const Output* output) {
+    active_->required.insert(output);
+    (*global_changes_)++;
   }
 
   void ProcessorRouter::connect(Processor* destination,
@@ -126,6 +369,12 @@ namespace mopo {
     }
   }
 
+  void ProcessorRouter::disconnect(const Processor* destination) {
+    MOPO_ASSERT(destination->router() == this);
+    UNUSED(destination);
+    (*global_changes_)++;
+  }
+
   void ProcessorRouter::reorder(Processor* processor) {
     // Get all the dependencies inside this router.
     std::set<const Processor*> dependencies = getDependencies(processor);
@@ -157,6 +406,7 @@ namespace mopo {
 
     MOPO_ASSERT(new_order.size() == processors_.size());
     (*order_) = new_order;
+    (*global_changes_)++;
 
     // Make sure our parent is ordered as well.
     if (router_)
@@ -191,24 +441,186 @@ namespace mopo {
 
   void ProcessorRouter::addFeedback(Feedback* feedback) {
     feedback->router(this);
+    feedback->setSampleRate(sample_rate_);
+    feedback->setBufferSize(buffer_size_);
     feedback_order_->push_back(feedback);
     feedback_processors_[feedback] = feedback;
+    (*global_changes_)++;
   }
 
   void ProcessorRouter::updateAllProcessors() {
     size_t num_processors = order_->size();
-    for (int i = 0; i < num_processors; ++i) {
+    compiled_order_.resize(num_processors);
+    for (size_t i = 0; i < num_processors; ++i) {
       const Processor* next = order_->at(i);
-      if (processors_.find(next) == processors_.end())
+      if (processors_.find(next) == processors_.end()) {
         processors_[next] = next->clone();
+        if (localization_)
+          processors_[next]->localize(localization_);
+      }
+      compiled_order_[i] = processors_[next];
     }
 
     size_t num_feedbacks = feedback_order_->size();
-    for (int i = 0; i < num_feedbacks; ++i) {
+    compiled_feedback_order_.resize(num_feedbacks);
+    for (size_t i = 0; i < num_feedbacks; ++i) {
       const Feedback* next = feedback_order_->at(i);
-      if (feedback_processors_.find(next) == feedback_processors_.end())
+      if (feedback_processors_.find(next) == feedback_processors_.end()) {
         feedback_processors_[next] = new Feedback(*next);
+        if (localization_)
+          feedback_processors_[next]->localize(localization_);
+      }
+      compiled_feedback_order_[i] = feedback_processors_[next];
     }
+
+    // Room for every processor so later changes to what processors read
+    // don't allocate.
+    active_order_.reserve(num_processors);
+    updateActiveOrder();
+
+    local_changes_ = *global_changes_;
+
+    // Localized copies have to follow any rewiring of the original.
+    if (localization_)
+      relink(this, localization_);
+
+    if (pool_buffers_)
+      assignBuffers();
+  }
+
+  void ProcessorRouter::updateActiveOrder() {
+    updateActiveProcessors();
+
+    size_t num_processors = compiled_order_.size();
+    active_order_.clear();
+    for (size_t i = 0; i < num_processors; ++i) {
+      if (active_->active[i])
+        active_order_.push_back(compiled_order_[i]);
+    }
+    local_input_changes_ = active_->input_changes;
+  }
+
+  void ProcessorRouter::updateActiveProcessors() {
+    bool topology_changed = active_->changes != *global_changes_;
+    if (!topology_changed &&
+        active_->active_input_changes == active_->input_changes) {
+      return;
+    }
+
+    if (topology_changed) {
+      active_->changes = *global_changes_;
+      compileDependencies();
+    }
+    active_->active_input_changes = active_->input_changes;
+
+    size_t num_processors = order_->size();
+    std::vector<bool>& active = active_->active;
+    if (active_->required.empty()) {
+      active.assign(num_processors, true);
+      return;
+    }
+
+    active.assign(num_processors, false);
+    for (size_t i = 0; i < active_->roots.size(); ++i)
+      active[active_->roots[i]] = true;
+
+    // Dependencies come before what reads them so walking backwards usually
+    // finds everything in one pass.
+    const std::vector<Dependency>& dependencies = active_->dependencies;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (int d = dependencies.size() - 1; d >= 0; --d) {
+        const Dependency& dependency = dependencies[d];
+        if (active[dependency.processor] && !active[dependency.source] &&
+            (dependency.reader == NULL ||
+             dependency.reader->readsInput(dependency.input))) {
+          active[dependency.source] = true;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  void ProcessorRouter::compileDependencies() {
+    size_t num_processors = order_->size();
+    std::map<const Processor*, int> indices;
+    for (size_t i = 0; i < num_processors; ++i)
+      indices[order_->at(i)] = i;
+
+    // Feedback is read on the next buffer so we can't tell who needs it.
+    // Keep whatever feeds it running. Processors without outputs are only
+    // there for what they do, and skipping always active ones would lose
+    // state, like the triggers an envelope follows.
+    std::vector<const Processor*> roots;
+    std::set<const Output*>::iterator iter = active_->required.begin();
+    for (; iter != active_->required.end(); ++iter)
+      roots.push_back((*iter)->owner);
+    size_t num_feedbacks = feedback_order_->size();
+    for (size_t i = 0; i < num_feedbacks; ++i)
+      roots.push_back(feedback_order_->at(i)->input()->source->owner);
+    for (size_t i = 0; i < num_processors; ++i) {
+      const Processor* processor = order_->at(i);
+      if (processor->numOutputs() == 0 || processor->alwaysActive())
+        roots.push_back(processor);
+    }
+
+    active_->roots.clear();
+    for (size_t i = 0; i < roots.size(); ++i) {
+      const Processor* context = getContext(roots[i]);
+      if (context)
+        active_->roots.push_back(indices[context]);
+    }
+
+    // A nested router runs all of its processors, so whatever any of them
+    // read is needed whenever the router is.
+    active_->dependencies.clear();
+    for (size_t i = 0; i < num_processors; ++i) {
+      std::vector<const Processor*> readers(1, order_->at(i));
+      for (size_t r = 0; r < readers.size(); ++r) {
+        const Processor* reader = readers[r];
+        const ProcessorRouter* router =
+            dynamic_cast<const ProcessorRouter*>(reader);
+        if (router) {
+          readers.insert(readers.end(),
+                         router->order_->begin(), router->order_->end());
+        }
+
+        for (int j = 0; j < reader->numInputs(); ++j) {
+          const Input* input = reader->input(j);
+          if (input->source == NULL || input->source->owner == NULL)
+            continue;
+
+          const Processor* source = getContext(input->source->owner);
+          if (source == NULL || source == order_->at(i))
+            continue;
+
+          Dependency dependency = { static_cast<int>(i), indices[source],
+                                    r == 0 ? reader : NULL, j };
+          active_->dependencies.push_back(dependency);
+        }
+      }
+    }
+  }
+
+  const Processor* ProcessorRouter::copyOf(const Processor* processor) const {
+    std::map<const Processor*, Processor*>::const_iterator iter =
+        processors_.find(processor);
+    MOPO_ASSERT(iter != processors_.end());
+    return iter->second;
+  }
+
+  Processor* ProcessorRouter::getCopy(const ProcessorRouter& original,
+                                      const Processor* processor) {
+    std::map<const Processor*, Processor*>::const_iterator iter =
+        original.processors_.begin();
+    for (; iter != original.processors_.end(); ++iter) {
+      if (iter->second == processor)
+        return processors_[iter->first];
+    }
+
+    MOPO_ASSERT(false);
+    return NULL;
   }
 
   const Processor* ProcessorRouter::getContext(const Processor* processor) {
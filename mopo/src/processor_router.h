@@ -33,17 +33,79 @@ namespace mopo {
       ProcessorRouter(int num_inputs = 0, int num_outputs = 0);
       ProcessorRouter(const ProcessorRouter& original);
 
+      // Frees every processor we hold, whether it was added to us or is our
+      // copy of one, and the shared graph if we are the original.
+      virtual ~ProcessorRouter();
+
       virtual Processor* clone() const { return new ProcessorRouter(*this); }
       virtual void process();
       virtual void setSampleRate(int sample_rate);
       virtual void setBufferSize(int buffer_size);
 
+      virtual void localize(Localization* localization);
+      virtual void relink(const Processor* original,
+                          const Localization* localization);
+
+#ifdef MOPO_COUNT_DENORMALS
+      virtual void collectSubnormals(const Processor* key,
+                                     SubnormalCounts* counts) const;
+#endif
+
+      // Our registered outputs may come from processors that don't rewrite
+      // them every time.
+      virtual bool rewritesOutputs() const { return false; }
+
       virtual void addProcessor(Processor* processor);
       virtual void removeProcessor(const Processor* processor);
 
+      // Once any output is required, only the processors that a required
+      // output depends on get processed and the rest are skipped. The set is
+      // shared with all copies and recomputed whenever the graph is rewired.
+      void requireOutput(const Output* output);
+
+      // Call when a processor in this router starts or stops reading one of
+      // its inputs, see Processor::readsInput. Unlike rewiring, this is safe
+      // on the audio thread. Every copy picks up the new active processors
+      // before its next buffer without allocating.
+      void inputsChanged() { active_->input_changes++; }
+
       // Any time new dependencies are added into the ProcessorRouter graph, we
       // should call _connect_ on the destination Processor and source Output.
       void connect(Processor* destination, const Output* source, int index);
+
+      // Any time dependencies are removed from the ProcessorRouter graph, we
+      // should call _disconnect_ on the destination Processor.
+      void disconnect(const Processor* destination);
+
+      // Catches up with topology changes so the next process() call doesn't
+      // have to create any processors, and with changes to what processors
+      // read.
+      void update() {
+        if (needsUpdate())
+          updateAllProcessors();
+        else if (local_input_changes_ != active_->input_changes)
+          updateActiveOrder();
+      }
+
+      // Processes localized copies of this router in lockstep. Each processor
+      // runs for all the copies before we move on to the next processor.
+      void processLockstep(ProcessorRouter* const* copies, int num_copies);
+
+      // Makes room for processing up to _num_copies_ copies in lockstep so
+      // processLockstep doesn't allocate.
+      void prepareLockstep(int num_copies);
+
+      // Lets the outputs of our processors share buffers from a pool sized to
+      // the buffer size. An output borrows a pooled buffer when its processor
+      // runs and gives it back after the last processor that reads it has
+      // run. Only use this on a localized copy, and list in _pinned_ any of
+      // its outputs that are read after process() returns.
+      void poolBuffers(const std::set<const Output*>& pinned);
+
+      // Returns our copy of _processor_, which was added to the router we
+      // were copied from.
+      const Processor* copyOf(const Processor* processor) const;
+
       bool isDownstream(const Processor* first, const Processor* second);
       bool areOrdered(const Processor* first, const Processor* second);
 
@@ -56,9 +118,33 @@ namespace mopo {
       // relation to all other Processors in _this_.
       void reorder(Processor* processor);
 
-      // Ensures we have all copies of all processors and feedback processors.
+      // Ensures we have all copies of all processors and feedback processors
+      // and rebuilds the compiled processing order from them.
       virtual void updateAllProcessors();
 
+      // Marks which processors in _order_ a required output depends on if
+      // the topology or what processors read changed since we last looked.
+      // Only a topology change allocates.
+      void updateActiveProcessors();
+
+      // Records what each processor in _order_ reads for
+      // updateActiveProcessors.
+      void compileDependencies();
+
+      // Rebuilds _active_order_ from the shared active processors.
+      void updateActiveOrder();
+
+      // Hands out pooled buffers to the outputs of the active order.
+      void assignBuffers();
+
+      // Returns true if the compiled processing order is out of date with
+      // the shared graph topology.
+      bool needsUpdate() const { return local_changes_ != *global_changes_; }
+
+      // Returns our copy of the processor that is _processor_ in _original_.
+      Processor* getCopy(const ProcessorRouter& original,
+                         const Processor* processor);
+
       // Returns the ancestor of _processor_ which is a child of _this_.
       // Returns NULL if _processor_ is not a descendant of _this_.
       const Processor* getContext(const Processor* processor);
@@ -69,6 +155,63 @@ namespace mopo {
 
       std::vector<const Feedback*>* feedback_order_;
       std::map<const Feedback*, Feedback*> feedback_processors_;
+
+      // The resolved processors of _order_ and _feedback_order_. These are
+      // only rebuilt when the topology changes so we don't have to look up
+      // processors every buffer.
+      std::vector<Processor*> compiled_order_;
+      std::vector<Feedback*> compiled_feedback_order_;
+
+      // The processors of _compiled_order_ that something required depends
+      // on. These are the ones we actually process.
+      std::vector<Processor*> active_order_;
+
+      // Processor _processor_ of _order_ reads input _input_ of _reader_,
+      // which is plugged into processor _source_ of _order_. _reader_ is the
+      // processor itself or, for a nested router, NULL.
+      struct Dependency {
+        int processor;
+        int source;
+        const Processor* reader;
+        int input;
+      };
+
+      // Which processors of _order_ are active, shared among all copies of
+      // this router. _changes_ is the topology change count it was built at
+      // and _active_input_changes_ the _input_changes_ count.
+      struct ActiveProcessors {
+        std::set<const Output*> required;
+        std::vector<bool> active;
+        int changes;
+
+        // Compiled from the topology. _roots_ are always needed.
+        std::vector<int> roots;
+        std::vector<Dependency> dependencies;
+
+        int input_changes;
+        int active_input_changes;
+      };
+      ActiveProcessors* active_;
+
+      // Topology change counter shared among all copies of this router.
+      int* global_changes_;
+      int local_changes_;
+      int local_input_changes_;
+
+      // Set on the router that created the shared graph above.
+      bool owns_graph_;
+
+      // Set if this copy has its own ports instead of its original's.
+      Localization* localization_;
+
+      // Scratch space for gathering one processor from each lockstep copy.
+      std::vector<Processor*> lockstep_bank_;
+
+      // Buffers lent to our processors' outputs. See _poolBuffers_.
+      bool pool_buffers_;
+      std::set<const Output*> pinned_outputs_;
+      std::vector<mopo_float*> buffer_pool_;
+      int pool_buffer_size_;
   };
 } // namespace mopo
 
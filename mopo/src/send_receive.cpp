@@ -20,12 +20,24 @@
 
 namespace mopo {
 
-  Send::Send() : Processor(1, 1) {
+  Send::Send(mopo_float max_delay_time) :
+      Processor(1, 1), max_delay_time_(max_delay_time),
+      memory_(Memory::sizeFor(max_delay_time, sample_rate_)) {
     memory_output_ = new MemoryOutput();
     memory_output_->owner = this;
     memory_output_->memory = &memory_;
   }
 
+  Send::~Send() {
+    if (memory_output_->owner == this)
+      delete memory_output_;
+  }
+
+  void Send::setSampleRate(int sample_rate) {
+    Processor::setSampleRate(sample_rate);
+    memory_.resize(Memory::sizeFor(max_delay_time_, sample_rate));
+  }
+
   void Send::process() {
     for (int i = 0; i < buffer_size_; ++i)
       memory_.push(inputs_[0]->at(i));
@@ -37,6 +49,11 @@ namespace mopo {
     memory_input_->owner = this;
   }
 
+  Receive::~Receive() {
+    if (memory_input_->owner == this)
+      delete memory_input_;
+  }
+
   void Receive::process() {
     mopo_float adjust = buffer_size_;
     if (router_ && !router_->areOrdered(memory_input_->source->owner,
@@ -52,11 +52,16 @@ namespace mopo {
 
   class Send : public Processor {
     public:
-      Send();
+      // Holds enough memory for Receives up to _max_delay_time_ seconds back.
+      Send(mopo_float max_delay_time = DEFAULT_MAX_DELAY_TIME);
+      virtual ~Send();
 
       virtual Processor* clone() const { return new Send(*this); }
       virtual void process();
 
+      // Resizes the memory for the new sample rate.
+      virtual void setSampleRate(int sample_rate);
+
       inline mopo_float get(mopo_float past) const {
         return memory_.get(past);
       }
@@ -64,6 +69,7 @@ namespace mopo {
       const MemoryOutput* memory_output() const { return memory_output_; }
 
     protected:
+      mopo_float max_delay_time_;
       Memory memory_;
 
       MemoryOutput* memory_output_;
@@ -78,6 +84,7 @@ namespace mopo {
       };
 
       Receive();
+      virtual ~Receive();
 
       virtual Processor* clone() const { return new Receive(*this); }
       virtual void process();
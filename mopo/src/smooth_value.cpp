@@ -31,6 +31,15 @@ namespace mopo {
   }
 
   void SmoothValue::process() {
+    // Once smoothing has settled every tick returns the same value.
+    bool settled = INTERPOLATE(value_, target_value_, decay_) == value_;
+    outputs_[0]->constant = settled;
+    if (settled) {
+      for (int i = 0; i < buffer_size_; ++i)
+        outputs_[0]->buffer[i] = value_;
+      return;
+    }
+
     for (int i = 0; i < buffer_size_; ++i)
       outputs_[0]->buffer[i] = tick();
   }
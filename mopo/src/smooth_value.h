@@ -28,6 +28,7 @@ namespace mopo {
 
       virtual Processor* clone() const { return new SmoothValue(*this); }
       virtual void process();
+      virtual bool rewritesOutputs() const { return true; }
 
       virtual void setSampleRate(int sample_rate);
 
@@ -0,0 +1,79 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <vector>
+
+#define CACHE_LINE_SIZE 64
+
+namespace mopo {
+
+  // A fixed size queue for handing items from one thread to another without
+  // locks or allocation, e.g. from an input thread to the audio thread.
+  // Exactly one thread may push and exactly one thread may pop.
+  template<class T>
+  class SpscQueue {
+    public:
+      // Holds at least _capacity_ items.
+      SpscQueue(int capacity) : read_(0), write_(0) {
+        unsigned int size = 1;
+        while (size < static_cast<unsigned int>(capacity))
+          size *= 2;
+        items_.resize(size);
+        mask_ = size - 1;
+      }
+
+      // Producer only. Returns false if the queue is full.
+      bool push(const T& item) {
+        unsigned int write = __atomic_load_n(&write_, __ATOMIC_RELAXED);
+        unsigned int read = __atomic_load_n(&read_, __ATOMIC_ACQUIRE);
+        if (write - read == items_.size())
+          return false;
+
+        items_[write & mask_] = item;
+        __atomic_store_n(&write_, write + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+
+      // Consumer only. Returns false if the queue is empty.
+      bool pop(T* item) {
+        unsigned int read = __atomic_load_n(&read_, __ATOMIC_RELAXED);
+        unsigned int write = __atomic_load_n(&write_, __ATOMIC_ACQUIRE);
+        if (read == write)
+          return false;
+
+        *item = items_[read & mask_];
+        __atomic_store_n(&read_, read + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+
+    private:
+      std::vector<T> items_;
+      unsigned int mask_;
+
+      // Keep the two ends on their own cache lines so the threads don't
+      // fight over them.
+      char padding1_[CACHE_LINE_SIZE];
+      unsigned int read_;
+      char padding2_[CACHE_LINE_SIZE];
+      unsigned int write_;
+  };
+} // namespace mopo
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,200 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "thread_pool.h"
+
+#include "denormals.h"
+#include "mopo.h"
+
+#include <sched.h>
+#include <sys/time.h>
+
+#define WORKER_SPIN_SECONDS 0.05
+#define WORKER_NAP_SECONDS 0.001
+#define RANGE_END_SHIFT 32
+
+namespace mopo {
+
+  namespace {
+    double now() {
+      struct timeval time;
+      gettimeofday(&time, 0);
+      return time.tv_sec + time.tv_usec / 1000000.0;
+    }
+
+    int rangeBegin(unsigned long long range) {
+      return static_cast<int>(range & 0xffffffffULL);
+    }
+
+    int rangeEnd(unsigned long long range) {
+      return static_cast<int>(range >> RANGE_END_SHIFT);
+    }
+  } // namespace
+
+  ThreadPool::ThreadPool(int num_threads) :
+      task_(0), batch_(0), active_workers_(0), running_(false),
+      flush_denormals_(false), quit_(false) {
+    MOPO_ASSERT(num_threads > 0);
+    pthread_mutex_init(&lock_, 0);
+    pthread_cond_init(&wake_, 0);
+
+    for (int i = 0; i < num_threads; ++i) {
+      Queue* queue = new Queue();
+      queue->range = 0;
+      queues_.push_back(queue);
+    }
+
+    // Thread 0 is whoever calls _run_.
+    workers_.resize(num_threads);
+    threads_.resize(num_threads);
+    for (int i = 1; i < num_threads; ++i) {
+      workers_[i].pool = this;
+      workers_[i].index = i;
+      pthread_create(&threads_[i], 0, workerLoop, &workers_[i]);
+    }
+  }
+
+  ThreadPool::~ThreadPool() {
+    pthread_mutex_lock(&lock_);
+    __atomic_store_n(&quit_, true, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&wake_);
+    pthread_mutex_unlock(&lock_);
+
+    for (size_t i = 1; i < threads_.size(); ++i)
+      pthread_join(threads_[i], 0);
+
+    for (size_t i = 0; i < queues_.size(); ++i)
+      delete queues_[i];
+
+    pthread_cond_destroy(&wake_);
+    pthread_mutex_destroy(&lock_);
+  }
+
+  void ThreadPool::run(Task* task, int num_jobs) {
+    if (num_jobs <= 0)
+      return;
+
+    int num_threads = queues_.size();
+    for (int i = 0; i < num_threads; ++i) {
+      unsigned long long begin = (i * num_jobs) / num_threads;
+      unsigned long long end = ((i + 1) * num_jobs) / num_threads;
+      __atomic_store_n(&queues_[i]->range, begin | (end << RANGE_END_SHIFT),
+                       __ATOMIC_RELAXED);
+    }
+
+    task_ = task;
+    flush_denormals_ = flushingDenormals();
+    __atomic_store_n(&running_, true, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&batch_, 1, __ATOMIC_SEQ_CST);
+
+    work(0);
+
+    // Every job has been taken. Workers joining from here on stay out so we
+    // only wait for the jobs still running.
+    __atomic_store_n(&running_, false, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&active_workers_, __ATOMIC_SEQ_CST))
+      ;
+  }
+
+  void* ThreadPool::workerLoop(void* data) {
+    Worker* worker = static_cast<Worker*>(data);
+    ThreadPool* pool = worker->pool;
+    int last_batch = 0;
+    bool flushing = flushingDenormals();
+
+    while (pool->waitForBatch(&last_batch)) {
+      // Join before checking the batch is still running. Either _run_ sees
+      // us and waits, or we see it finished and stay out.
+      __atomic_add_fetch(&pool->active_workers_, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&pool->running_, __ATOMIC_SEQ_CST)) {
+        bool flush = pool->flush_denormals_;
+        if (flush != flushing) {
+          setFlushDenormals(flush);
+          flushing = flush;
+        }
+
+        pool->work(worker->index);
+      }
+      __atomic_sub_fetch(&pool->active_workers_, 1, __ATOMIC_SEQ_CST);
+    }
+    return 0;
+  }
+
+  bool ThreadPool::waitForBatch(int* last_batch) {
+    double spin_until = now() + WORKER_SPIN_SECONDS;
+    while (true) {
+      if (__atomic_load_n(&quit_, __ATOMIC_SEQ_CST))
+        return false;
+
+      int batch = __atomic_load_n(&batch_, __ATOMIC_SEQ_CST);
+      if (batch != *last_batch) {
+        *last_batch = batch;
+        return true;
+      }
+
+      if (now() < spin_until) {
+        sched_yield();
+        continue;
+      }
+
+      // Nobody wakes us for a batch, we look again after a nap.
+      double wake_time = now() + WORKER_NAP_SECONDS;
+      struct timespec wake;
+      wake.tv_sec = static_cast<time_t>(wake_time);
+      wake.tv_nsec = static_cast<long>((wake_time - wake.tv_sec) * 1e9);
+      pthread_mutex_lock(&lock_);
+      if (!__atomic_load_n(&quit_, __ATOMIC_SEQ_CST))
+        pthread_cond_timedwait(&wake_, &lock_, &wake);
+      pthread_mutex_unlock(&lock_);
+    }
+  }
+
+  void ThreadPool::work(int index) {
+    int job = 0;
+    while (takeJob(index, &job) || stealJob(index, &job))
+      task_->runJob(job);
+  }
+
+  bool ThreadPool::takeJob(int index, int* job) {
+    // Taking past the end only moves the front further past it.
+    unsigned long long range =
+        __atomic_fetch_add(&queues_[index]->range, 1, __ATOMIC_ACQ_REL);
+    if (rangeBegin(range) >= rangeEnd(range))
+      return false;
+
+    *job = rangeBegin(range);
+    return true;
+  }
+
+  bool ThreadPool::stealJob(int index, int* job) {
+    int num_threads = queues_.size();
+    for (int i = 1; i < num_threads; ++i) {
+      Queue* victim = queues_[(index + i) % num_threads];
+      unsigned long long range =
+          __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+      while (rangeBegin(range) < rangeEnd(range)) {
+        unsigned long long stolen = range - (1ULL << RANGE_END_SHIFT);
+        if (__atomic_compare_exchange_n(&victim->range, &range, stolen, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+          *job = rangeEnd(stolen);
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+} // namespace mopo
@@ -0,0 +1,102 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <vector>
+
+namespace mopo {
+
+  // Runs batches of jobs on a set of worker threads and the calling thread.
+  // Each thread is dealt a contiguous range of the jobs up front. A thread
+  // that runs out of jobs steals from the back of another thread's range so
+  // jobs of different cost still balance out. Workers run each batch in the
+  // flush denormals mode of the thread that called _run_.
+  //
+  // _run_ never locks so it is safe to call from the audio thread. Jobs are
+  // taken and stolen with atomic operations. Workers spin for a while after
+  // a batch waiting for the next one, then nap and check for new batches
+  // every _WORKER_NAP_SECONDS_. A worker that shows up after every job was
+  // taken stays out of the batch, so _run_ only waits for jobs that are
+  // still running.
+  class ThreadPool {
+    public:
+      // The work done for each job of a batch. _runJob_ may be called from
+      // any of the pool's threads.
+      class Task {
+        public:
+          virtual ~Task() { }
+          virtual void runJob(int job) = 0;
+      };
+
+      // _num_threads_ includes the thread calling _run_.
+      ThreadPool(int num_threads);
+      ~ThreadPool();
+
+      int numThreads() const { return queues_.size(); }
+
+      // Runs _task_ for every job in [0, _num_jobs_) and returns when all of
+      // them are done.
+      void run(Task* task, int num_jobs);
+
+    private:
+      // The range of jobs a thread has left. The first job is in the low 32
+      // bits and the end in the high 32 bits so the owner can take from the
+      // front with one add and thieves can take from the back with one
+      // compare and swap, and both see each other's changes.
+      struct Queue {
+        unsigned long long range;
+      };
+
+      struct Worker {
+        ThreadPool* pool;
+        int index;
+      };
+
+      static void* workerLoop(void* data);
+
+      // Waits until the batch number isn't _*last_batch_ or we're quitting,
+      // and updates _*last_batch_. Returns false if we're quitting.
+      bool waitForBatch(int* last_batch);
+
+      // Runs jobs from thread _index_'s queue, then steals from the others
+      // until there are none left.
+      void work(int index);
+      bool takeJob(int index, int* job);
+      bool stealJob(int index, int* job);
+
+      std::vector<Queue*> queues_;
+      std::vector<Worker> workers_;
+      std::vector<pthread_t> threads_;
+
+      // Only used for napping workers and waking them to quit.
+      pthread_mutex_t lock_;
+      pthread_cond_t wake_;
+
+      Task* task_;
+      int batch_;
+      int active_workers_;
+      bool running_;
+      bool flush_denormals_;
+      bool quit_;
+  };
+} // namespace mopo
+
+#endif // THREAD_POOL_H
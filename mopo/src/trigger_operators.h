@@ -29,6 +29,7 @@ namespace mopo {
       virtual Processor* clone() const { return new TriggerCombiner(*this); }
 
       void process();
+      virtual bool rewritesOutputs() const { return false; }
   };
 
   class TriggerWait : public Processor {
@@ -44,6 +45,7 @@ namespace mopo {
       virtual Processor* clone() const { return new TriggerWait(*this); }
 
       void process();
+      virtual bool rewritesOutputs() const { return false; }
 
     private:
       void waitTrigger(mopo_float trigger_value);
@@ -72,6 +74,9 @@ namespace mopo {
       virtual Processor* clone() const { return new LegatoFilter(*this); }
 
       void process();
+      virtual bool rewritesOutputs() const { return false; }
+      // We'd miss triggers while skipped.
+      virtual bool alwaysActive() const { return true; }
 
     private:
       mopo_float last_value_;
@@ -97,6 +102,9 @@ namespace mopo {
       virtual Processor* clone() const { return new PortamentoFilter(*this); }
 
       void process();
+      virtual bool rewritesOutputs() const { return false; }
+      // We'd miss triggers while skipped.
+      virtual bool alwaysActive() const { return true; }
 
     private:
       mopo_float last_value_;
@@ -37,6 +37,23 @@ namespace mopo {
       }
       return true;
     }
+
+    // Approximates tan(_x_) for _x_ in [0, PI / 2) with a [5/4] Pade
+    // approximant on [0, PI / 4] and tan(x) = 1 / tan(PI / 2 - x) above that.
+    // The relative error is below 1.4e-8 over the whole range.
+    inline mopo_float fastTan(mopo_float x) {
+      const mopo_float quarter_pi = PI / 4.0;
+      bool reflect = x > quarter_pi;
+      if (reflect)
+        x = PI / 2.0 - x;
+
+      mopo_float x_squared = x * x;
+      mopo_float numerator = x * (945.0 - x_squared * (105.0 - x_squared));
+      mopo_float denominator = 945.0 - x_squared * (420.0 - 15.0 * x_squared);
+      if (reflect)
+        return denominator / numerator;
+      return numerator / denominator;
+    }
   } // namespace utils
 } // namespace mopo
 
@@ -19,8 +19,9 @@
 namespace mopo {
 
   Value::Value(mopo_float value) : Processor(kNumInputs, 1), value_(value) {
-    for (int i = 0; i < MAX_BUFFER_SIZE; ++i)
+    for (int i = 0; i < outputs_[0]->buffer_size; ++i)
       outputs_[0]->buffer[i] = value_;
+    outputs_[0]->constant = true;
   }
 
   void Value::process() {
@@ -31,13 +32,16 @@ namespace mopo {
     }
 
     int i = 0;
+    outputs_[0]->constant = true;
     if (inputs_[kSet]->source->triggered) {
       int trigger_offset = inputs_[kSet]->source->trigger_offset;
 
       for (; i < trigger_offset; ++i)
         outputs_[0]->buffer[i] = value_;
 
-      value_ = inputs_[kSet]->source->trigger_value;
+      mopo_float new_value = inputs_[kSet]->source->trigger_value;
+      outputs_[0]->constant = trigger_offset == 0 || new_value == value_;
+      value_ = new_value;
     }
 
     for (; i < buffer_size_; ++i)
@@ -46,7 +50,11 @@ namespace mopo {
 
   void Value::set(mopo_float value) {
     value_ = value;
-    for (int i = 0; i < buffer_size_; ++i)
+
+    // Values that aren't in a router are never processed or resized so fill
+    // the whole buffer.
+    for (int i = 0; i < outputs_[0]->buffer_size; ++i)
       outputs_[0]->buffer[i] = value_;
+    outputs_[0]->constant = true;
   }
 } // namespace mopo
@@ -34,6 +34,9 @@ namespace mopo {
       virtual Processor* clone() const { return new Value(*this); }
       virtual void process();
 
+      // We only rewrite our buffer when the value changes.
+      virtual bool rewritesOutputs() const { return false; }
+
       mopo_float value() const { return value_; }
       virtual void set(mopo_float value);
 
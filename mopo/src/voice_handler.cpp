@@ -16,28 +16,130 @@
 
 #include "voice_handler.h"
 
+#include "envelope.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+
+#define PEAK_DECAY_SECONDS 0.05
+#define CREATED_VOICE_QUEUE_SIZE 64
+#define FULL_QUEUE_WAIT_MICROSECONDS 1000
+
 namespace mopo {
 
-  Voice::Voice(Processor* processor) : processor_(processor) { }
+  Voice::Voice(ProcessorRouter* processor, Processor::Output* voice_event,
+               Processor::Output* note, Processor::Output* velocity) :
+      sustained_(false), peak_(0.0), new_event_(false), deferred_off_(false),
+      event_offset_(0),
+      processor_(processor),
+      voice_event_(voice_event), note_(note), velocity_(velocity),
+      localization_(0), killer_(0) {
+    state_.event = kVoiceOff;
+    state_.note = 0.0;
+    state_.velocity = 0.0;
+  }
+
+  Voice::~Voice() {
+    delete processor_;
+    if (localization_) {
+      delete voice_event_;
+      delete note_;
+      delete velocity_;
+      delete localization_;
+    }
+  }
+
+  void Voice::localize() {
+    MOPO_ASSERT(localization_ == 0);
+    localization_ = new Processor::Localization();
+    localization_->outputs[voice_event_] =
+        new Processor::Output(voice_event_->buffer_size);
+    localization_->outputs[note_] = new Processor::Output(note_->buffer_size);
+    localization_->outputs[velocity_] =
+        new Processor::Output(velocity_->buffer_size);
+    voice_event_ = localization_->outputs[voice_event_];
+    note_ = localization_->outputs[note_];
+    velocity_ = localization_->outputs[velocity_];
+
+    processor_->localize(localization_);
+    processor_->relink(processor_, localization_);
+  }
+
+  PressedNotes::PressedNotes() : last_(-1) {
+    for (int i = 0; i < MIDI_SIZE; ++i) {
+      notes_[i] = 0.0;
+      pressed_[i] = false;
+      prev_[i] = -1;
+      next_[i] = -1;
+    }
+  }
+
+  void PressedNotes::press(mopo_float note) {
+    int index = slot(note);
+    if (pressed_[index])
+      release(notes_[index]);
+
+    notes_[index] = note;
+    pressed_[index] = true;
+    prev_[index] = last_;
+    next_[index] = -1;
+    if (last_ >= 0)
+      next_[last_] = index;
+    last_ = index;
+  }
+
+  void PressedNotes::release(mopo_float note) {
+    int index = slot(note);
+    if (!pressed_[index] || notes_[index] != note)
+      return;
+
+    pressed_[index] = false;
+    if (prev_[index] >= 0)
+      next_[prev_[index]] = next_[index];
+    if (next_[index] >= 0)
+      prev_[next_[index]] = prev_[index];
+    else
+      last_ = prev_[index];
+  }
 
   VoiceHandler::VoiceHandler(size_t polyphony) :
-      Processor(kNumInputs, 1), polyphony_(0), sustain_(false),
-      voice_output_(0), voice_killer_(0) {
+      Processor(kNumInputs, 1), polyphony_(0), peak_decay_(0.0),
+      sustain_(false),
+      voice_bank_(false), voice_output_(0), voice_killer_(0),
+      killer_envelope_(0),
+      sustained_voices_(Voice::kSustainLinks), num_voices_(0),
+      created_voices_(CREATED_VOICE_QUEUE_SIZE), voices_to_create_(0),
+      creating_voices_(false), voice_thread_running_(false),
+      thread_pool_(0) {
+    for (int i = 0; i < MIDI_SIZE; ++i)
+      note_voices_[i].setKind(Voice::kNoteLinks);
+    createVoices(polyphony);
     setPolyphony(polyphony);
   }
 
+  VoiceHandler::~VoiceHandler() {
+    waitForVoices();
+    delete thread_pool_;
+    for (size_t i = 0; i < all_voices_.size(); ++i)
+      delete all_voices_[i];
+  }
+
   void VoiceHandler::prepareVoiceTriggers(Voice* voice) {
-    note_.clearTrigger();
-    velocity_.clearTrigger();
-    voice_event_.clearTrigger();
+    Output* note = voice->note();
+    Output* velocity = voice->velocity();
+    Output* voice_event = voice->voice_event();
+    note->clearTrigger();
+    velocity->clearTrigger();
+    voice_event->clearTrigger();
 
     if (voice->hasNewEvent()) {
-      voice_event_.trigger(voice->state()->event);
+      int offset = voice->eventOffset();
+      voice_event->trigger(voice->state()->event, offset);
       if (voice->state()->event == kVoiceOn) {
-        note_.trigger(voice->state()->note);
-        velocity_.trigger(voice->state()->velocity);
+        note->trigger(voice->state()->note, offset);
+        velocity->trigger(voice->state()->velocity, offset);
       }
 
       voice->clearEvent();
@@ -46,122 +148,374 @@ namespace mopo {
 
   void VoiceHandler::processVoice(Voice* voice) {
     voice->processor()->process();
-    for (int i = 0; i < buffer_size_; ++i)
-      outputs_[0]->buffer[i] += voice_output_->buffer[i];
+    addVoiceOutput(voice);
+  }
+
+  void VoiceHandler::addVoiceOutput(Voice* voice) {
+    // Track the voice's peak while we're here for choosing voices to steal.
+    const mopo_float* buffer = voice->local(voice_output_)->buffer;
+    mopo_float peak = peak_decay_ * voice->peak();
+    for (int i = 0; i < buffer_size_; ++i) {
+      outputs_[0]->buffer[i] += buffer[i];
+      peak = std::max<mopo_float>(peak, fabs(buffer[i]));
+    }
+    voice->setPeak(peak);
+  }
+
+  void VoiceHandler::setVoiceKiller(const Envelope* killer) {
+    MOPO_ASSERT(!localizedVoices());
+    waitForVoices();
+    voice_killer_ = 0;
+    killer_envelope_ = killer;
+    voice_router_.requireOutput(killer->output(Envelope::kValue));
+
+    // Voices look up their copy of the new killer the next time we ask.
+    for (size_t i = 0; i < all_voices_.size(); ++i)
+      all_voices_[i]->setKiller(0);
+  }
+
+  bool VoiceHandler::voiceFinished(Voice* voice) {
+    if (voice->state()->event == kVoiceOn)
+      return false;
+
+    // The voice's envelope stops at exactly zero once its release is silent.
+    if (killer_envelope_) {
+      if (voice->killer() == 0) {
+        voice->setKiller(static_cast<const Envelope*>(
+            voice->processor()->copyOf(killer_envelope_)));
+      }
+      const Envelope* killer = voice->killer();
+      return killer->state() == Envelope::kReleasing && killer->value() == 0.0;
+    }
+
+    // Otherwise done when the killer has a full silent buffer.
+    if (voice_killer_ == 0)
+      return false;
+
+    // Killers that know they went silent, like a released Envelope, mark
+    // their output constant so we only have to look at one sample.
+    const Output* killer = voice->local(voice_killer_);
+    if (killer->constant)
+      return utils::closeToZero(killer->buffer[0]);
+    return utils::isSilent(killer->buffer, buffer_size_);
+  }
+
+  void VoiceHandler::freeVoice(Voice* voice) {
+    active_voices_.erase(voice);
+    note_voices_[PressedNotes::slot(voice->state()->note)].erase(voice);
+    free_voices_.pushBack(voice);
+  }
+
+  void VoiceHandler::activateVoice(Voice* voice, mopo_float note,
+                                   mopo_float velocity, int offset) {
+    voice->activate(note, velocity, offset);
+    note_voices_[PressedNotes::slot(note)].pushBack(voice);
+  }
+
+  void VoiceHandler::processVoiceBank() {
+    voice_bank_routers_.clear();
+    Voice* voice = active_voices_.front();
+    for (; voice; voice = active_voices_.next(voice)) {
+      prepareVoiceTriggers(voice);
+      voice_bank_routers_.push_back(voice->processor());
+    }
+
+    if (voice_bank_routers_.size()) {
+      voice_router_.processLockstep(&voice_bank_routers_[0],
+                                    voice_bank_routers_.size());
+    }
+
+    gatherVoiceOutputs();
+  }
+
+  void VoiceHandler::processVoiceThreads() {
+    std::vector<Voice*>& voices = voice_task_.voices;
+    voices.clear();
+    Voice* voice = active_voices_.front();
+    for (; voice; voice = active_voices_.next(voice)) {
+      prepareVoiceTriggers(voice);
+
+      // Topology changes create processors so do them before the workers
+      // start.
+      voice->processor()->update();
+      voices.push_back(voice);
+    }
+
+    thread_pool_->run(&voice_task_, voices.size());
+    gatherVoiceOutputs();
+  }
+
+  void VoiceHandler::gatherVoiceOutputs() {
+    Voice* voice = active_voices_.front();
+    while (voice) {
+      Voice* next = active_voices_.next(voice);
+      addVoiceOutput(voice);
+      if (voiceFinished(voice))
+        freeVoice(voice);
+      voice = next;
+    }
   }
 
   void VoiceHandler::process() {
+    takeCreatedVoices();
     global_router_.process();
 
     size_t polyphony = static_cast<size_t>(inputs_[kPolyphony]->at(0));
     setPolyphony(CLAMP(polyphony, 1, polyphony));
     memset(outputs_[0]->buffer, 0, buffer_size_ * sizeof(mopo_float));
+    peak_decay_ = exp(-buffer_size_ / (PEAK_DECAY_SECONDS * sample_rate_));
+
+    if (thread_pool_) {
+      processVoiceThreads();
+      return;
+    }
+    if (voice_bank_) {
+      processVoiceBank();
+      return;
+    }
 
-    std::list<Voice*>::iterator iter = active_voices_.begin();
-    while (iter != active_voices_.end()) {
-      Voice* voice = *iter;
+    Voice* voice = active_voices_.front();
+    while (voice) {
+      Voice* next = active_voices_.next(voice);
       prepareVoiceTriggers(voice);
       processVoice(voice);
-
-      // Remove voice if the right processor has a full silent buffer.
-      if (voice_killer_ && voice->state()->event != kVoiceOn &&
-          utils::isSilent(voice_killer_->buffer, buffer_size_)) {
-        free_voices_.push_back(voice);
-        iter = active_voices_.erase(iter);
-      }
-      else
-        iter++;
+      if (voiceFinished(voice))
+        freeVoice(voice);
+      voice = next;
     }
   }
 
+#ifdef MOPO_COUNT_DENORMALS
+  void VoiceHandler::collectSubnormals(const Processor* key,
+                                       SubnormalCounts* counts) const {
+    Processor::collectSubnormals(key, counts);
+    global_router_.collectSubnormals(&global_router_, counts);
+    for (size_t i = 0; i < all_voices_.size(); ++i)
+      all_voices_[i]->processor()->collectSubnormals(&voice_router_, counts);
+  }
+#endif
+
   void VoiceHandler::setSampleRate(int sample_rate) {
+    waitForVoices();
     Processor::setSampleRate(sample_rate);
     voice_router_.setSampleRate(sample_rate);
     global_router_.setSampleRate(sample_rate);
-    std::set<Voice*>::iterator iter = all_voices_.begin();
-    for (; iter != all_voices_.end(); ++iter)
-      (*iter)->processor()->setSampleRate(sample_rate);
+    for (size_t i = 0; i < all_voices_.size(); ++i)
+      all_voices_[i]->processor()->setSampleRate(sample_rate);
   }
 
   void VoiceHandler::setBufferSize(int buffer_size) {
+    waitForVoices();
     Processor::setBufferSize(buffer_size);
     voice_router_.setBufferSize(buffer_size);
     global_router_.setBufferSize(buffer_size);
-    std::set<Voice*>::iterator iter = all_voices_.begin();
-    for (; iter != all_voices_.end(); ++iter)
-      (*iter)->processor()->setBufferSize(buffer_size);
+    voice_event_.resizeBuffer(buffer_size);
+    note_.resizeBuffer(buffer_size);
+    velocity_.resizeBuffer(buffer_size);
+
+    for (size_t i = 0; i < all_voices_.size(); ++i) {
+      Voice* voice = all_voices_[i];
+      voice->processor()->setBufferSize(buffer_size);
+      voice->voice_event()->resizeBuffer(buffer_size);
+      voice->note()->resizeBuffer(buffer_size);
+      voice->velocity()->resizeBuffer(buffer_size);
+    }
   }
 
   void VoiceHandler::sustainOn() {
     sustain_ = true;
   }
 
-  void VoiceHandler::sustainOff() {
+  void VoiceHandler::sustainOff(int offset) {
+    offset = CLAMP(offset, 0, buffer_size_ - 1);
     sustain_ = false;
-    std::list<Voice*>::iterator iter = sustained_voices_.begin();
-    for (; iter != sustained_voices_.end(); ++iter) {
-      Voice* voice = *iter;
-      voice->deactivate();
+    while (!sustained_voices_.empty()) {
+      Voice* voice = sustained_voices_.popFront();
+      voice->setSustained(false);
+      voice->deactivate(offset);
     }
-    sustained_voices_.clear();
   }
 
-  void VoiceHandler::noteOn(mopo_float note, mopo_float velocity) {
+  void VoiceHandler::noteOn(mopo_float note, mopo_float velocity, int offset) {
+    offset = CLAMP(offset, 0, buffer_size_ - 1);
     Voice* voice = 0;
-    pressed_notes_.push_back(note);
-    if (free_voices_.size() && active_voices_.size() < polyphony_) {
-      voice = free_voices_.front();
-      free_voices_.pop_front();
-    }
+    pressed_notes_.press(note);
+    if (polyphony_ == 0)
+      return;
+
+    if (!free_voices_.empty() && active_voices_.size() < polyphony_)
+      voice = free_voices_.popFront();
     else {
-      voice = active_voices_.front();
-      active_voices_.pop_front();
+      voice = chooseStolenVoice(note);
+      active_voices_.erase(voice);
+      note_voices_[PressedNotes::slot(voice->state()->note)].erase(voice);
     }
 
-    voice->activate(note, velocity);
-    active_voices_.push_back(voice);
+    activateVoice(voice, note, velocity, offset);
+    active_voices_.pushBack(voice);
   }
 
-  void VoiceHandler::noteOff(mopo_float note) {
-    std::list<mopo_float>::iterator note_iter = pressed_notes_.begin();
-    while (note_iter != pressed_notes_.end()) {
-      if (*note_iter == note)
-        note_iter = pressed_notes_.erase(note_iter);
-      else
-        note_iter++;
+  Voice* VoiceHandler::chooseStolenVoice(mopo_float note) {
+    int steal = static_cast<int>(inputs_[kVoiceSteal]->at(0));
+    Voice* oldest = active_voices_.front();
+
+    if (steal == kStealSameNote) {
+      VoiceList* voices = &note_voices_[PressedNotes::slot(note)];
+      Voice* voice = voices->front();
+      for (; voice; voice = voices->next(voice)) {
+        if (voice->state()->note == note)
+          return voice;
+      }
+    }
+    else if (steal == kStealReleased) {
+      Voice* voice = oldest;
+      for (; voice; voice = active_voices_.next(voice)) {
+        if (voice->state()->event == kVoiceOff)
+          return voice;
+      }
+    }
+    else if (steal == kStealQuietest) {
+      // Voices that haven't played yet have no peak so leave them alone.
+      Voice* quietest = 0;
+      Voice* voice = oldest;
+      for (; voice; voice = active_voices_.next(voice)) {
+        if (!voice->hasNewEvent() &&
+            (quietest == 0 || voice->peak() < quietest->peak())) {
+          quietest = voice;
+        }
+      }
+      if (quietest)
+        return quietest;
     }
 
-    std::list<Voice*>::iterator iter = active_voices_.begin();
-    for (; iter != active_voices_.end(); ++iter) {
-      Voice* voice = *iter;
+    return oldest;
+  }
+
+  void VoiceHandler::noteOff(mopo_float note, int offset) {
+    offset = CLAMP(offset, 0, buffer_size_ - 1);
+    pressed_notes_.release(note);
+
+    // Voices can move to another note while we go through these.
+    VoiceList* voices = &note_voices_[PressedNotes::slot(note)];
+    Voice* voice = voices->front();
+    while (voice) {
+      Voice* next = voices->next(voice);
       if (voice->state()->note == note) {
-        if (sustain_)
-          sustained_voices_.push_back(voice);
+        if (sustain_) {
+          if (!voice->sustained()) {
+            voice->setSustained(true);
+            sustained_voices_.pushBack(voice);
+          }
+        }
         else {
-          if (polyphony_ == 1 && pressed_notes_.size())
-            voice->activate(pressed_notes_.back(), voice->state()->velocity);
+          if (polyphony_ == 1 && !pressed_notes_.empty()) {
+            voices->erase(voice);
+            activateVoice(voice, pressed_notes_.last(),
+                          voice->state()->velocity, offset);
+          }
           else
-            voice->deactivate();
+            voice->deactivate(offset);
         }
       }
+      voice = next;
     }
   }
 
   void VoiceHandler::setPolyphony(size_t polyphony) {
-    while (all_voices_.size() < polyphony) {
-      Voice* new_voice = createVoice();
-      all_voices_.insert(new_voice);
-      free_voices_.push_back(new_voice);
-    }
-
+    polyphony = std::min(polyphony, num_voices_);
     while (active_voices_.size() > polyphony) {
-      active_voices_.front()->deactivate();
-      active_voices_.pop_front();
+      Voice* voice = active_voices_.front();
+      voice->deactivate();
+      freeVoice(voice);
     }
 
     polyphony_ = polyphony;
   }
 
+  void VoiceHandler::createVoices(size_t num_voices) {
+    prepareVoices(num_voices);
+    while (all_voices_.size() < num_voices) {
+      Voice* voice = createVoice();
+      all_voices_.push_back(voice);
+      free_voices_.pushBack(voice);
+      num_voices_++;
+    }
+  }
+
+  void VoiceHandler::createVoicesInBackground(size_t num_voices) {
+    prepareVoices(num_voices);
+    if (all_voices_.size() >= num_voices)
+      return;
+
+    voices_to_create_ = num_voices;
+    __atomic_store_n(&creating_voices_, true, __ATOMIC_RELEASE);
+    pthread_create(&voice_thread_, 0, createVoicesThread, this);
+    voice_thread_running_ = true;
+  }
+
+  void VoiceHandler::waitForVoices() {
+    if (voice_thread_running_) {
+      pthread_join(voice_thread_, 0);
+      voice_thread_running_ = false;
+    }
+  }
+
+  void* VoiceHandler::createVoicesThread(void* data) {
+    VoiceHandler* handler = static_cast<VoiceHandler*>(data);
+    while (handler->all_voices_.size() < handler->voices_to_create_) {
+      Voice* voice = handler->createVoice();
+      handler->all_voices_.push_back(voice);
+      while (!handler->created_voices_.push(voice))
+        usleep(FULL_QUEUE_WAIT_MICROSECONDS);
+    }
+
+    __atomic_store_n(&handler->creating_voices_, false, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  void VoiceHandler::prepareVoices(size_t num_voices) {
+    waitForVoices();
+    all_voices_.reserve(num_voices);
+    voice_bank_routers_.reserve(num_voices);
+    voice_router_.prepareLockstep(num_voices);
+    voice_task_.voices.reserve(num_voices);
+
+    // Voices made before the voice graph was finished would otherwise catch
+    // up the first time they are processed. Updating the original first
+    // means the copies only read the shared active processor set.
+    voice_router_.update();
+    for (size_t i = 0; i < all_voices_.size(); ++i)
+      all_voices_[i]->processor()->update();
+  }
+
+  void VoiceHandler::takeCreatedVoices() {
+    Voice* voice = 0;
+    while (created_voices_.pop(&voice)) {
+      free_voices_.pushBack(voice);
+      num_voices_++;
+    }
+  }
+
+  void VoiceHandler::setVoiceBank(bool voice_bank) {
+    waitForVoices();
+    voice_bank_ = voice_bank;
+    if (!voice_bank_)
+      return;
+
+    localizeAllVoices();
+  }
+
+  void VoiceHandler::setVoiceThreads(int num_threads) {
+    waitForVoices();
+    delete thread_pool_;
+    thread_pool_ = 0;
+    if (num_threads <= 1)
+      return;
+
+    thread_pool_ = new ThreadPool(num_threads);
+    localizeAllVoices();
+  }
+
   void VoiceHandler::addProcessor(Processor* processor) {
     voice_router_.addProcessor(processor);
   }
@@ -171,6 +525,30 @@ namespace mopo {
   }
 
   Voice* VoiceHandler::createVoice() {
-    return new Voice(voice_router_.clone());
+    Voice* voice = new Voice(new ProcessorRouter(voice_router_),
+                             &voice_event_, &note_, &velocity_);
+    if (localizedVoices())
+      localizeVoice(voice);
+    return voice;
+  }
+
+  void VoiceHandler::localizeVoice(Voice* voice) {
+    voice->localize();
+
+    // A localized voice only has its own outputs so we are the only one that
+    // reads them after the voice has been processed.
+    std::set<const Output*> pinned;
+    if (voice_output_)
+      pinned.insert(voice->local(voice_output_));
+    if (voice_killer_)
+      pinned.insert(voice->local(voice_killer_));
+    voice->processor()->poolBuffers(pinned);
+  }
+
+  void VoiceHandler::localizeAllVoices() {
+    for (size_t i = 0; i < all_voices_.size(); ++i) {
+      if (!all_voices_[i]->localized())
+        localizeVoice(all_voices_[i]);
+    }
   }
 } // namespace mopo
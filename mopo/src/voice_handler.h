@@ -19,35 +19,78 @@
 #define VOICE_HANDLER_H
 
 #include "processor_router.h"
+#include "spsc_queue.h"
+#include "thread_pool.h"
 #include "value.h"
 
 #include <map>
-#include <list>
+#include <vector>
 
 namespace mopo {
 
+  class Envelope;
+  class Voice;
+
   struct VoiceState {
     VoiceEvent event;
     mopo_float note;
     mopo_float velocity;
   };
 
+  // A voice's place in a VoiceList.
+  struct VoiceLinks {
+    VoiceLinks() : prev(0), next(0) { }
+
+    Voice* prev;
+    Voice* next;
+  };
+
   class Voice {
     public:
-      Voice(Processor* voice);
+      Voice(ProcessorRouter* voice, Processor::Output* voice_event,
+            Processor::Output* note, Processor::Output* velocity);
 
-      Processor* processor() { return processor_; }
+      // Frees the voice's processors and, once localized, its own ports.
+      ~Voice();
+
+      ProcessorRouter* processor() { return processor_; }
       const VoiceState* state() { return &state_; }
 
-      void activate(mopo_float note, mopo_float velocity) {
+      // The trigger outputs this voice's processors read from.
+      Processor::Output* voice_event() { return voice_event_; }
+      Processor::Output* note() { return note_; }
+      Processor::Output* velocity() { return velocity_; }
+
+      // Gives this voice its own ports, including its own trigger outputs
+      // instead of the ones shared between all voices.
+      void localize();
+      bool localized() const { return localization_ != 0; }
+
+      // Returns this voice's version of _output_.
+      const Processor::Output* local(const Processor::Output* output) const {
+        return localization_ ? localization_->local(output) : output;
+      }
+
+      // _offset_ is the sample in the next buffer the event happens at.
+      void activate(mopo_float note, mopo_float velocity, int offset = 0) {
         new_event_ = true;
+        deferred_off_ = false;
+        event_offset_ = offset;
         state_.event = kVoiceOn;
         state_.note = note;
         state_.velocity = velocity;
       }
 
-      void deactivate() {
+      // A voice only passes on one event per buffer so turning off a voice
+      // whose note on hasn't been processed yet waits for the next buffer.
+      void deactivate(int offset = 0) {
+        if (new_event_ && state_.event == kVoiceOn) {
+          deferred_off_ = true;
+          return;
+        }
+
         new_event_ = true;
+        event_offset_ = offset;
         state_.event = kVoiceOff;
       }
 
@@ -55,34 +98,183 @@ namespace mopo {
         return new_event_;
       }
 
+      int eventOffset() {
+        return event_offset_;
+      }
+
       void clearEvent() {
         new_event_ = false;
+        if (deferred_off_) {
+          deferred_off_ = false;
+          deactivate();
+        }
       }
 
+      // A voice can be in one list of each kind at a time.
+      enum LinkKind {
+        kQueueLinks,
+        kNoteLinks,
+        kSustainLinks,
+        kNumLinkKinds
+      };
+
+      VoiceLinks* links(LinkKind kind) { return &links_[kind]; }
+
+      // If the sustain pedal is holding this voice.
+      bool sustained() const { return sustained_; }
+      void setSustained(bool sustained) { sustained_ = sustained; }
+
+      // The voice's recent peak output, decaying over time.
+      mopo_float peak() const { return peak_; }
+      void setPeak(mopo_float peak) { peak_ = peak; }
+
+      // This voice's copy of the envelope that ends it, if there is one.
+      const Envelope* killer() const { return killer_; }
+      void setKiller(const Envelope* killer) { killer_ = killer; }
+
     private:
+      VoiceLinks links_[kNumLinkKinds];
+      bool sustained_;
+      mopo_float peak_;
       bool new_event_;
+      bool deferred_off_;
+      int event_offset_;
       VoiceState state_;
-      Processor* processor_;
+      ProcessorRouter* processor_;
+      Processor::Output* voice_event_;
+      Processor::Output* note_;
+      Processor::Output* velocity_;
+      Processor::Localization* localization_;
+      const Envelope* killer_;
+  };
+
+  // A list of voices linked through the voices themselves so adding and
+  // removing voices never allocates.
+  class VoiceList {
+    public:
+      VoiceList(Voice::LinkKind kind = Voice::kQueueLinks) :
+          kind_(kind), front_(0), back_(0), size_(0) { }
+
+      void setKind(Voice::LinkKind kind) {
+        MOPO_ASSERT(size_ == 0);
+        kind_ = kind;
+      }
+
+      Voice* front() const { return front_; }
+      Voice* next(Voice* voice) const { return voice->links(kind_)->next; }
+      size_t size() const { return size_; }
+      bool empty() const { return size_ == 0; }
+
+      void pushBack(Voice* voice) {
+        VoiceLinks* links = voice->links(kind_);
+        links->prev = back_;
+        links->next = 0;
+        if (back_)
+          back_->links(kind_)->next = voice;
+        else
+          front_ = voice;
+        back_ = voice;
+        size_++;
+      }
+
+      void erase(Voice* voice) {
+        VoiceLinks* links = voice->links(kind_);
+        if (links->prev)
+          links->prev->links(kind_)->next = links->next;
+        else
+          front_ = links->next;
+        if (links->next)
+          links->next->links(kind_)->prev = links->prev;
+        else
+          back_ = links->prev;
+        links->prev = 0;
+        links->next = 0;
+        size_--;
+      }
+
+      Voice* popFront() {
+        Voice* voice = front_;
+        erase(voice);
+        return voice;
+      }
+
+    private:
+      Voice::LinkKind kind_;
+      Voice* front_;
+      Voice* back_;
+      size_t size_;
+  };
+
+  // The notes held down, in the order they were pressed. A note pressed
+  // again moves to the back. There is one slot per MIDI note so this never
+  // allocates.
+  class PressedNotes {
+    public:
+      PressedNotes();
+
+      void press(mopo_float note);
+      void release(mopo_float note);
+
+      bool empty() const { return last_ < 0; }
+      mopo_float last() const { return notes_[last_]; }
+
+      static int slot(mopo_float note) {
+        return CLAMP(static_cast<int>(note), 0, MIDI_SIZE - 1);
+      }
+
+    private:
+      mopo_float notes_[MIDI_SIZE];
+      bool pressed_[MIDI_SIZE];
+      int prev_[MIDI_SIZE];
+      int next_[MIDI_SIZE];
+      int last_;
+  };
+
+  // Processes one voice per job on a ThreadPool.
+  class VoiceTask : public ThreadPool::Task {
+    public:
+      virtual void runJob(int job) { voices[job]->processor()->process(); }
+
+      std::vector<Voice*> voices;
   };
 
   class VoiceHandler : public Processor {
     public:
       enum Inputs {
         kPolyphony,
+        kVoiceSteal,
         kNumInputs
       };
 
+      // Which voice a new note takes when all of them are playing.
+      enum VoiceSteal {
+        kStealOldest,
+        kStealQuietest,
+        kStealReleased,
+        kStealSameNote,
+        kNumVoiceSteals
+      };
+
       VoiceHandler(size_t polyphony = 1);
+      ~VoiceHandler();
 
       virtual Processor* clone() const { MOPO_ASSERT(false); return NULL; }
       virtual void process();
       virtual void setSampleRate(int sample_rate);
       virtual void setBufferSize(int buffer_size);
 
-      void noteOn(mopo_float note, mopo_float velocity = 1);
-      void noteOff(mopo_float note);
+#ifdef MOPO_COUNT_DENORMALS
+      // Every voice counts as the voice router. Don't call this while voices
+      // are being created in the background.
+      virtual void collectSubnormals(const Processor* key,
+                                     SubnormalCounts* counts) const;
+#endif
+
+      // _offset_ is the sample in the next buffer the event happens at.
+      void noteOn(mopo_float note, mopo_float velocity = 1, int offset = 0);
+      void noteOff(mopo_float note, int offset = 0);
       void sustainOn();
-      void sustainOff();
+      void sustainOff(int offset = 0);
 
       Output* voice_event() { return &voice_event_; }
       Output* note() { return &note_; }
@@ -91,39 +283,124 @@ namespace mopo {
       void addProcessor(Processor* processor);
       void addGlobalProcessor(Processor* processor);
 
+      // Turns on up to _polyphony_ of the voices that have been created.
       void setPolyphony(size_t polyphony);
 
+      // Makes sure there are at least _num_voices_ voices. Voices are only
+      // ever created by these, never by process(). Don't call these while
+      // process() might be running.
+      void createVoices(size_t num_voices);
+
+      // Creates the voices on a background thread instead. process() picks
+      // them up as they are finished. Until creatingVoices() returns false
+      // the voice graph's connections must not change.
+      void createVoicesInBackground(size_t num_voices);
+      bool creatingVoices() const {
+        return __atomic_load_n(&creating_voices_, __ATOMIC_ACQUIRE);
+      }
+
+      // Returns once the background thread is done.
+      void waitForVoices();
+
+      // In voice bank mode every voice gets its own ports and all active
+      // voices are processed in lockstep, one processor at a time. The output
+      // is the same as processing the voices one after another.
+      void setVoiceBank(bool voice_bank);
+
+      // Spreads the active voices over _num_threads_ threads, including the
+      // calling thread. As in voice bank mode every voice gets its own ports.
+      // Voice outputs are summed in the same order as always so the output
+      // doesn't depend on the number of threads. 1 turns the threads off.
+      void setVoiceThreads(int num_threads);
+
+      // Set these before turning on voice bank mode or voice threads. Only
+      // the voice processors these depend on get processed.
       void setVoiceOutput(const Output* output) {
+        MOPO_ASSERT(!localizedVoices());
         voice_output_ = output;
+        voice_router_.requireOutput(output);
       }
       void setVoiceOutput(const Processor* output) {
         setVoiceOutput(output->output());
       }
       void setVoiceKiller(const Output* killer) {
+        MOPO_ASSERT(!localizedVoices());
         voice_killer_ = killer;
+        killer_envelope_ = 0;
+        voice_router_.requireOutput(killer);
       }
       void setVoiceKiller(const Processor* killer) {
         setVoiceKiller(killer->output());
       }
 
+      // Ends voices once their copy of _killer_ has released to silence. We
+      // ask each copy for its state instead of looking at its output.
+      void setVoiceKiller(const Envelope* killer);
+
+      // Keeps _output_ computed in every voice even if neither the voice
+      // output nor the voice killer depends on it, e.g. for a meter.
+      void requireVoiceOutput(const Output* output) {
+        voice_router_.requireOutput(output);
+      }
+
     private:
+      static void* createVoicesThread(void* data);
+
+      // Gets ready for _num_voices_ voices so taking them on never
+      // allocates.
+      void prepareVoices(size_t num_voices);
+      void takeCreatedVoices();
       Voice* createVoice();
+      bool localizedVoices() const { return voice_bank_ || thread_pool_; }
+      void localizeVoice(Voice* voice);
+      void localizeAllVoices();
       void prepareVoiceTriggers(Voice* voice);
       void processVoice(Voice* voice);
+      void addVoiceOutput(Voice* voice);
+      bool voiceFinished(Voice* voice);
+      void freeVoice(Voice* voice);
+      Voice* chooseStolenVoice(mopo_float note);
+      // Activates a voice that isn't listed under any note.
+      void activateVoice(Voice* voice, mopo_float note, mopo_float velocity,
+                         int offset);
+      void processVoiceBank();
+      void processVoiceThreads();
+
+      // Adds the active voices' outputs together and frees finished voices.
+      void gatherVoiceOutputs();
 
       size_t polyphony_;
+      mopo_float peak_decay_;
       bool sustain_;
+      bool voice_bank_;
       const Output* voice_output_;
       const Output* voice_killer_;
+      const Envelope* killer_envelope_;
       Output voice_event_;
       Output note_;
       Output velocity_;
 
-      std::list<mopo_float> pressed_notes_;
-      std::set<Voice*> all_voices_;
-      std::list<Voice*> free_voices_;
-      std::list<Voice*> sustained_voices_;
-      std::list<Voice*> active_voices_;
+      // Nothing here allocates once the voices are created. Active voices
+      // are also listed under their note so note offs don't search.
+      PressedNotes pressed_notes_;
+      VoiceList free_voices_;
+      VoiceList active_voices_;
+      VoiceList note_voices_[MIDI_SIZE];
+      VoiceList sustained_voices_;
+      size_t num_voices_;
+
+      // Every voice created, including ones process() hasn't taken yet. Only
+      // the creating thread touches this.
+      std::vector<Voice*> all_voices_;
+      SpscQueue<Voice*> created_voices_;
+      size_t voices_to_create_;
+      bool creating_voices_;
+      bool voice_thread_running_;
+      pthread_t voice_thread_;
+
+      std::vector<ProcessorRouter*> voice_bank_routers_;
+      ThreadPool* thread_pool_;
+      VoiceTask voice_task_;
 
       ProcessorRouter voice_router_;
       ProcessorRouter global_router_;
@@ -23,122 +23,119 @@
 #include <cstdlib>
 
 #define LOOKUP_SIZE 2048
+// The bits of a fixed point phase below the lookup table index.
+// LOOKUP_SIZE is 2^(32 - LOOKUP_FRACTION_BITS).
+#define LOOKUP_FRACTION_BITS 21
 #define HIGH_FREQUENCY 20000
-#define MAX_HARMONICS 100
+// One mipmap level per octave of harmonics, from 1 up to MAX_HARMONICS.
+// Notes low enough to need more than that use the plain waveforms.
+#define MIPMAP_LEVELS 10
+#define MAX_HARMONICS (1 << (MIPMAP_LEVELS - 1))
 
 namespace mopo {
 
+  // A fixed point phase. A whole cycle is 2^32 so it wraps around by itself.
+  typedef unsigned int mopo_phase;
+
+  const double PHASE_CYCLE = 4294967296.0;
+  const mopo_phase HALF_PHASE = 0x80000000u;
+
+  // Converts a phase in cycles to the nearest fixed point phase, keeping the
+  // fractional part.
+  inline mopo_phase toPhase(double cycles) {
+    double scaled = cycles * PHASE_CYCLE;
+    long long phase = scaled + (scaled < 0.0 ? -0.5 : 0.5);
+    return static_cast<mopo_phase>(phase);
+  }
+
+  inline mopo_float fromPhase(mopo_phase phase) {
+    return phase * (1.0 / PHASE_CYCLE);
+  }
+
+  // The sin table and the band limited tables of the other waveforms. Those
+  // are mipmaps with one level per octave of harmonics, level _n_ holding the
+  // first 2^_n_ harmonics, stored as floats. All of the tables are generated
+  // at build time by generate_tables.cpp so they're read only data shared by
+  // every process instead of being computed at startup.
   class WaveLookup {
     public:
-      WaveLookup() {
-        // Sin lookup table.
-        for (int i = 0; i < LOOKUP_SIZE + 1; ++i)
-          sin_[i] = sin((2 * PI * i) / LOOKUP_SIZE);
-
-        // Square lookup table.
-        for (int i = 0; i < LOOKUP_SIZE + 1; ++i) {
-          int p = i;
-          mopo_float scale = 4.0 / PI;
-          square_[0][i] = scale * sin_[p];
-
-          for (int h = 1; h < MAX_HARMONICS; ++h) {
-            p = (p + i) % LOOKUP_SIZE;
-            square_[h][i] = square_[h - 1][i];
-
-            if (h % 2 == 0)
-              square_[h][i] += scale * sin_[p] / (h + 1);
-          }
-        }
-
-        // Saw lookup table.
-        for (int i = 0; i < LOOKUP_SIZE + 1; ++i) {
-          int index = (i + (LOOKUP_SIZE / 2)) % LOOKUP_SIZE;
-          int p = i;
-          mopo_float scale = 2.0 / PI;
-          saw_[0][index] = scale * sin_[p];
-
-          for (int h = 1; h < MAX_HARMONICS; ++h) {
-            p = (p + i) % LOOKUP_SIZE;
-            mopo_float harmonic = scale * sin_[p] / (h + 1);
-
-            if (h % 2 == 0)
-              saw_[h][index] = saw_[h - 1][index] + harmonic;
-            else
-              saw_[h][index] = saw_[h - 1][index] - harmonic;
-          }
-        }
-
-        // Triangle lookup table.
-        for (int i = 0; i < LOOKUP_SIZE + 1; ++i) {
-          int p = i;
-          mopo_float scale = 8.0 / (PI * PI);
-          triangle_[0][i] = scale * sin_[p];
-
-          for (int h = 1; h < MAX_HARMONICS; ++h) {
-            p = (p + i) % LOOKUP_SIZE;
-            triangle_[h][i] = triangle_[h - 1][i];
-            mopo_float harmonic = scale * sin_[p] / ((h + 1) * (h + 1));
-
-            if (h % 4 == 0)
-              triangle_[h][i] += harmonic;
-            else if (h % 2 == 0)
-              triangle_[h][i] -= harmonic;
-          }
-        }
-      }
+      enum Mipmap {
+        kSquareMipmap,
+        kSawMipmap,
+        kTriangleMipmap,
+        kNumMipmaps
+      };
 
       inline mopo_float fullsin(mopo_float t) const {
-        double integral;
-        mopo_float fractional = modf(t * LOOKUP_SIZE, &integral);
-        int index = integral;
-        return INTERPOLATE(sin_[index], sin_[index + 1], fractional);
+        return fullsinAt(toPhase(t));
       }
 
       inline mopo_float square(mopo_float t, int harmonics) const {
-        double integral;
-        mopo_float fractional = modf(t * LOOKUP_SIZE, &integral);
-        int index = integral;
-        return INTERPOLATE(square_[harmonics][index],
-                           square_[harmonics][index + 1], fractional);
+        return squareAt(toPhase(t), harmonics);
       }
 
       inline mopo_float upsaw(mopo_float t, int harmonics) const {
-        double integral;
-        mopo_float fractional = modf(t * LOOKUP_SIZE, &integral);
-        int index = integral;
-        return INTERPOLATE(saw_[harmonics][index],
-                           saw_[harmonics][index + 1], fractional);
+        return upsawAt(toPhase(t), harmonics);
       }
 
       inline mopo_float downsaw(mopo_float t, int harmonics) const {
-        return -upsaw(t, harmonics);
+        return downsawAt(toPhase(t), harmonics);
       }
 
       inline mopo_float triangle(mopo_float t, int harmonics) const {
-        double integral;
-        mopo_float fractional = modf(t * LOOKUP_SIZE, &integral);
-        int index = integral;
-        return INTERPOLATE(triangle_[harmonics][index],
-                           triangle_[harmonics][index + 1], fractional);
+        return triangleAt(toPhase(t), harmonics);
       }
 
       template<size_t steps>
       inline mopo_float step(mopo_float t, int harmonics) const {
-        return (1.0 * steps) / (steps - 1) * (upsaw(t, harmonics) +
-               downsaw(steps * t, harmonics / steps) / steps);
+        return stepAt<steps>(toPhase(t), harmonics);
       }
 
       template<size_t steps>
       inline mopo_float pyramid(mopo_float t, int harmonics) const {
-        size_t squares = steps - 1;
-        mopo_float phase_increment = 1.0 / (2.0 * squares);
+        return pyramidAt<steps>(toPhase(t), harmonics);
+      }
 
-        mopo_float phase = 0.5 + t;
-        mopo_float out = 0.0;
+      // The same waveforms at a fixed point phase. The top bits of the phase
+      // index the table and the rest interpolate, so nothing has to wrap.
+      inline mopo_float fullsinAt(mopo_phase phase) const {
+        int index = phase >> LOOKUP_FRACTION_BITS;
+        mopo_float fractional = fraction(phase);
+        return INTERPOLATE(sin_[index], sin_[index + 1], fractional);
+      }
 
-        double integral;
+      inline mopo_float squareAt(mopo_phase phase, int harmonics) const {
+        return bandLimited(kSquareMipmap, phase, harmonics);
+      }
+
+      inline mopo_float upsawAt(mopo_phase phase, int harmonics) const {
+        return bandLimited(kSawMipmap, phase, harmonics);
+      }
+
+      inline mopo_float downsawAt(mopo_phase phase, int harmonics) const {
+        return -upsawAt(phase, harmonics);
+      }
+
+      inline mopo_float triangleAt(mopo_phase phase, int harmonics) const {
+        return bandLimited(kTriangleMipmap, phase, harmonics);
+      }
+
+      template<size_t steps>
+      inline mopo_float stepAt(mopo_phase phase, int harmonics) const {
+        mopo_phase step_phase = steps * phase;
+        return (1.0 * steps) / (steps - 1) * (upsawAt(phase, harmonics) +
+               downsawAt(step_phase, harmonics / steps) / steps);
+      }
+
+      template<size_t steps>
+      inline mopo_float pyramidAt(mopo_phase phase, int harmonics) const {
+        const size_t squares = steps - 1;
+        const mopo_phase phase_increment = HALF_PHASE / squares;
+
+        phase += HALF_PHASE;
+        mopo_float out = 0.0;
         for (size_t i = 0; i < squares; ++i) {
-          out += square(modf(phase, &integral), harmonics);
+          out += squareAt(phase, harmonics);
           phase += phase_increment;
         }
         out /= squares;
@@ -146,11 +143,39 @@ namespace mopo {
       }
 
     private:
+      static inline mopo_float fraction(mopo_phase phase) {
+        const mopo_float fraction_scale = 1.0 / (1 << LOOKUP_FRACTION_BITS);
+        return (phase & ((1 << LOOKUP_FRACTION_BITS) - 1)) * fraction_scale;
+      }
+
+      // Reads the two levels of _mipmap_ around _harmonics_ + 1 harmonics.
+      // The lower level has every harmonic up to the octave below the count
+      // and the higher one fades in the rest, so the count is met exactly at
+      // each octave and the tone doesn't jump from one octave to the next.
+      inline mopo_float bandLimited(Mipmap mipmap, mopo_phase phase,
+                                    int harmonics) const {
+        const float* low = mipmaps_[mipmap] + low_level_[harmonics];
+        const float* high = mipmaps_[mipmap] + high_level_[harmonics];
+        int index = phase >> LOOKUP_FRACTION_BITS;
+        mopo_float fractional = fraction(phase);
+
+        mopo_float low_value = INTERPOLATE(low[index], low[index + 1],
+                                           fractional);
+        mopo_float high_value = INTERPOLATE(high[index], high[index + 1],
+                                            fractional);
+        return INTERPOLATE(low_value, high_value, fade_[harmonics]);
+      }
+
       // Make them 1 larger for wrapping.
-      mopo_float sin_[LOOKUP_SIZE + 1];
-      mopo_float square_[MAX_HARMONICS][LOOKUP_SIZE + 1];
-      mopo_float saw_[MAX_HARMONICS][LOOKUP_SIZE + 1];
-      mopo_float triangle_[MAX_HARMONICS][LOOKUP_SIZE + 1];
+      static const mopo_float sin_[LOOKUP_SIZE + 1];
+      static const float mipmaps_[kNumMipmaps][MIPMAP_LEVELS *
+                                               (LOOKUP_SIZE + 1)];
+
+      // Offsets of the levels to read for each number of harmonics and how
+      // much of the higher level to read.
+      static const int low_level_[MAX_HARMONICS];
+      static const int high_level_[MAX_HARMONICS];
+      static const mopo_float fade_[MAX_HARMONICS];
   };
 
   class Wave {
@@ -207,6 +232,85 @@ namespace mopo {
         }
       }
 
+      // Returns the harmonics blwave uses at _frequency_, or -1 if it's low
+      // enough to use the plain waveform.
+      static inline int harmonics(mopo_float frequency) {
+        if (fabs(frequency) < 1)
+          return -1;
+        int harmonics = HIGH_FREQUENCY / fabs(frequency) - 1;
+        if (harmonics >= MAX_HARMONICS)
+          return -1;
+        return harmonics;
+      }
+
+      // A version of blwave for each waveform at a fixed point phase so
+      // oscillators can choose one per block instead of switching every
+      // sample. _harmonics_ comes from harmonics().
+      template<Type waveform>
+      static inline mopo_float blwave(mopo_phase phase, int harmonics) {
+        if (harmonics < 0)
+          return wave<waveform>(phase);
+
+        switch (waveform) {
+          case kSin:
+            return lookup_.fullsinAt(phase);
+          case kTriangle:
+            return lookup_.triangleAt(phase, harmonics);
+          case kSquare:
+            return lookup_.squareAt(phase, harmonics);
+          case kDownSaw:
+            return lookup_.downsawAt(phase, harmonics);
+          case kUpSaw:
+            return lookup_.upsawAt(phase, harmonics);
+          case kThreeStep:
+            return lookup_.stepAt<3>(phase, harmonics);
+          case kFourStep:
+            return lookup_.stepAt<4>(phase, harmonics);
+          case kEightStep:
+            return lookup_.stepAt<8>(phase, harmonics);
+          case kThreePyramid:
+            return lookup_.pyramidAt<3>(phase, harmonics);
+          case kFivePyramid:
+            return lookup_.pyramidAt<5>(phase, harmonics);
+          case kNinePyramid:
+            return lookup_.pyramidAt<9>(phase, harmonics);
+          default:
+            return wave<waveform>(phase);
+        }
+      }
+
+      template<Type waveform>
+      static inline mopo_float wave(mopo_phase phase) {
+        switch (waveform) {
+          case kSin:
+            return lookup_.fullsinAt(phase);
+          case kSquare:
+            return squareAt(phase);
+          case kTriangle:
+            return triangleAt(phase);
+          case kDownSaw:
+            return downsawAt(phase);
+          case kUpSaw:
+            return upsawAt(phase);
+          case kThreeStep:
+            return stepAt<3>(phase);
+          case kFourStep:
+            return stepAt<4>(phase);
+          case kEightStep:
+            return stepAt<8>(phase);
+          case kThreePyramid:
+            return pyramidAt<3>(phase);
+          case kFivePyramid:
+            return pyramidAt<5>(phase);
+          case kNinePyramid:
+            return pyramidAt<9>(phase);
+          case kWhiteNoise:
+            return whitenoise();
+          default:
+            return 0;
+        }
+      }
+
       static inline mopo_float wave(Type waveform, mopo_float t) {
         switch (waveform) {
           case kSin:
@@ -246,6 +350,10 @@ namespace mopo {
         return (2.0 * rand()) / RAND_MAX - 1;
       }
 
+      static inline mopo_float whitenoise(unsigned int* seed) {
+        return (2.0 * rand_r(seed)) / RAND_MAX - 1;
+      }
+
       static inline mopo_float fullsin(mopo_float t) {
         return lookup_.fullsin(t);
       }
@@ -294,6 +402,50 @@ namespace mopo {
         return out;
       }
 
+      // The plain waveforms at a fixed point phase.
+      // A phase that lands on the square's edge rounds differently than the
+      // floating point phase did, so a square can switch one sample earlier
+      // or later than square(t). As an LFO on pitch that shift carries into
+      // the oscillator phase for the rest of the note.
+      static inline mopo_float squareAt(mopo_phase phase) {
+        return phase < HALF_PHASE ? 1 : -1;
+      }
+
+      static inline mopo_float triangleAt(mopo_phase phase) {
+        mopo_phase shifted = phase + HALF_PHASE + HALF_PHASE / 2;
+        return fabs(2.0 - 4.0 * fromPhase(shifted)) - 1;
+      }
+
+      static inline mopo_float downsawAt(mopo_phase phase) {
+        return -upsawAt(phase);
+      }
+
+      static inline mopo_float upsawAt(mopo_phase phase) {
+        return fromPhase(phase) * 2 - 1;
+      }
+
+      template<size_t steps>
+      static inline mopo_float stepAt(mopo_phase phase) {
+        unsigned long long scaled = phase;
+        mopo_float section = (steps * scaled) >> 32;
+        return 2 * section / (steps - 1) - 1;
+      }
+
+      template<size_t steps>
+      static inline mopo_float pyramidAt(mopo_phase phase) {
+        const size_t squares = steps - 1;
+        const mopo_phase phase_increment = HALF_PHASE / squares;
+
+        phase += HALF_PHASE;
+        mopo_float out = 0.0;
+        for (size_t i = 0; i < squares; ++i) {
+          out += squareAt(phase);
+          phase += phase_increment;
+        }
+        out /= squares;
+        return out;
+      }
+
     protected:
       static const WaveLookup lookup_;
   };
@@ -0,0 +1,228 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks that banked filters output exactly what the same filters output one
+// at a time, and that filters start from fresh coefficients after a voice
+// reset or a sample rate change. Prints each failed check and exits with a
+// failure status so `make check` catches it.
+
+#include "filter.h"
+#include "value.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#define SAMPLE_RATE 44100
+#define BUFFER_SIZE 256
+#define NUM_BUFFERS 4
+#define COEFFICIENT_INTERVAL 16
+#define NUM_FILTERS 11
+#define RESET_FILTER 3
+#define RESET_BUFFER 2
+#define RESET_SAMPLE 37
+#define LOW_CUTOFF 200.0
+#define HIGH_CUTOFF 5000.0
+
+namespace mopo {
+  namespace {
+    int failures = 0;
+
+    void check(bool passed, Filter::Type type, const char* description) {
+      if (!passed) {
+        fprintf(stderr, "FAIL (type %d): %s\n", type, description);
+        failures++;
+      }
+    }
+
+    // Fills _audio_ with a deterministic signal unique to _seed_.
+    void fillAudio(Processor::Output* audio, int seed, int buffer) {
+      for (int i = 0; i < BUFFER_SIZE; ++i) {
+        int sample = buffer * BUFFER_SIZE + i;
+        audio->buffer[i] = sin(0.05 * (seed + 1) * sample) +
+                           0.5 * sin(0.31 * sample + seed);
+      }
+    }
+
+    // A cutoff sweep so every coefficient segment ramps.
+    void fillCutoff(Processor::Output* cutoff, int seed, int buffer) {
+      for (int i = 0; i < BUFFER_SIZE; ++i) {
+        int sample = buffer * BUFFER_SIZE + i;
+        cutoff->buffer[i] = 400.0 + 300.0 * seed +
+                            250.0 * sin(0.003 * sample + seed);
+      }
+    }
+
+    Filter* createFilter(Filter::Type type, Processor::Output* audio,
+                         Processor::Output* cutoff, Processor::Output* reset,
+                         Value* resonance, Value* type_value) {
+      Filter* filter = new Filter();
+      filter->setCoefficientInterval(COEFFICIENT_INTERVAL);
+      filter->plug(audio, Filter::kAudio);
+      filter->plug(type_value, Filter::kType);
+      filter->plug(cutoff, Filter::kCutoff);
+      filter->plug(resonance, Filter::kResonance);
+      filter->plug(reset, Filter::kReset);
+      filter->setSampleRate(SAMPLE_RATE);
+      filter->setBufferSize(BUFFER_SIZE);
+      return filter;
+    }
+
+    bool sameOutput(const Filter* a, const Filter* b, int a_start,
+                    int b_start, int samples) {
+      for (int i = 0; i < samples; ++i) {
+        if (a->output()->buffer[a_start + i] !=
+            b->output()->buffer[b_start + i]) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Banks wider than the lanes, with one filter resetting mid buffer.
+    void testBankMatchesPlain(Filter::Type type) {
+      Value resonance(2.0);
+      Value type_value(type);
+      Processor::Output* audio[NUM_FILTERS];
+      Processor::Output* cutoff[NUM_FILTERS];
+      Processor::Output* reset[NUM_FILTERS];
+      Processor* plain[NUM_FILTERS];
+      Processor* banked[NUM_FILTERS];
+
+      for (int f = 0; f < NUM_FILTERS; ++f) {
+        audio[f] = new Processor::Output();
+        cutoff[f] = new Processor::Output();
+        reset[f] = new Processor::Output();
+        plain[f] = createFilter(type, audio[f], cutoff[f], reset[f],
+                                &resonance, &type_value);
+        banked[f] = createFilter(type, audio[f], cutoff[f], reset[f],
+                                 &resonance, &type_value);
+      }
+
+      bool same = true;
+      for (int b = 0; b < NUM_BUFFERS; ++b) {
+        for (int f = 0; f < NUM_FILTERS; ++f) {
+          fillAudio(audio[f], f, b);
+          fillCutoff(cutoff[f], f, b);
+          reset[f]->clearTrigger();
+        }
+        if (b == RESET_BUFFER)
+          reset[RESET_FILTER]->trigger(kVoiceReset, RESET_SAMPLE);
+
+        for (int f = 0; f < NUM_FILTERS; ++f)
+          plain[f]->process();
+        banked[0]->processBank(banked, NUM_FILTERS);
+
+        for (int f = 0; f < NUM_FILTERS; ++f) {
+          same = same && sameOutput(static_cast<Filter*>(plain[f]),
+                                    static_cast<Filter*>(banked[f]),
+                                    0, 0, BUFFER_SIZE);
+        }
+      }
+      check(same, type, "banked filters don't match single filters");
+
+      for (int f = 0; f < NUM_FILTERS; ++f) {
+        delete plain[f];
+        delete banked[f];
+        delete audio[f];
+        delete cutoff[f];
+        delete reset[f];
+      }
+    }
+
+    // After a reset the filter plays exactly like a new filter at the new
+    // cutoff instead of ramping from the old one.
+    void testResetSnaps(Filter::Type type) {
+      Value resonance(2.0);
+      Value type_value(type);
+      Processor::Output audio, cutoff, reset;
+      Processor::Output fresh_audio, fresh_cutoff, fresh_reset;
+      Filter* filter = createFilter(type, &audio, &cutoff, &reset,
+                                    &resonance, &type_value);
+      Filter* fresh = createFilter(type, &fresh_audio, &fresh_cutoff,
+                                   &fresh_reset, &resonance, &type_value);
+
+      fillAudio(&audio, 0, 0);
+      for (int i = 0; i < BUFFER_SIZE; ++i)
+        cutoff.buffer[i] = LOW_CUTOFF;
+      filter->process();
+
+      fillAudio(&audio, 0, 1);
+      for (int i = 0; i < BUFFER_SIZE; ++i)
+        cutoff.buffer[i] = i < RESET_SAMPLE ? LOW_CUTOFF : HIGH_CUTOFF;
+      reset.trigger(kVoiceReset, RESET_SAMPLE);
+      filter->process();
+
+      for (int i = 0; i < BUFFER_SIZE; ++i) {
+        int shifted = i + RESET_SAMPLE;
+        fresh_audio.buffer[i] = shifted < BUFFER_SIZE ? audio.buffer[shifted]
+                                                      : 0.0;
+        fresh_cutoff.buffer[i] = HIGH_CUTOFF;
+      }
+      fresh->process();
+
+      check(sameOutput(filter, fresh, RESET_SAMPLE, 0,
+                       BUFFER_SIZE - RESET_SAMPLE),
+            type, "a reset filter ramps from the last note's coefficients");
+
+      delete filter;
+      delete fresh;
+    }
+
+    // After a sample rate change the filter plays exactly like a new filter
+    // at that sample rate.
+    void testSampleRateChange(Filter::Type type) {
+      Value resonance(2.0);
+      Value type_value(type);
+      Processor::Output audio, cutoff, reset;
+      Filter* filter = createFilter(type, &audio, &cutoff, &reset,
+                                    &resonance, &type_value);
+      Filter* fresh = createFilter(type, &audio, &cutoff, &reset,
+                                   &resonance, &type_value);
+
+      for (int i = 0; i < BUFFER_SIZE; ++i)
+        cutoff.buffer[i] = HIGH_CUTOFF;
+      filter->process();
+
+      filter->setSampleRate(SAMPLE_RATE / 2);
+      fresh->setSampleRate(SAMPLE_RATE / 2);
+      fillAudio(&audio, 0, 0);
+      filter->process();
+      fresh->process();
+
+      check(sameOutput(filter, fresh, 0, 0, BUFFER_SIZE), type,
+            "a filter keeps its coefficients after a sample rate change");
+
+      delete filter;
+      delete fresh;
+    }
+  } // namespace
+} // namespace mopo
+
+int main() {
+  for (int type = 0; type < mopo::Filter::kNumTypes; ++type) {
+    mopo::Filter::Type filter_type = static_cast<mopo::Filter::Type>(type);
+    mopo::testBankMatchesPlain(filter_type);
+    mopo::testResetSnaps(filter_type);
+    mopo::testSampleRateChange(filter_type);
+  }
+
+  if (mopo::failures) {
+    fprintf(stderr, "%d checks failed\n", mopo::failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
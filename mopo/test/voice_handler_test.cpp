@@ -0,0 +1,164 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * mopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mopo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks that VoiceHandler plays notes at the samples they were placed on,
+// in every voice processing mode. Prints each failed check and exits with a
+// failure status so `make check` catches it.
+
+#include "envelope.h"
+#include "value.h"
+#include "voice_handler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#define SAMPLE_RATE 44100
+#define BUFFER_SIZE 1024
+#define POLYPHONY 4
+#define VOICE_THREADS 2
+#define RELEASE_SECONDS 0.01
+#define SHORT_NOTE_SAMPLES 220
+#define NOTE_OFF_SAMPLE 300
+#define TAIL_BUFFERS 8
+
+namespace mopo {
+  namespace {
+    enum Mode {
+      kPlain,
+      kVoiceBank,
+      kVoiceThreads,
+      kNumModes
+    };
+
+    const char* mode_names[kNumModes] = {
+      "plain",
+      "voice bank",
+      "voice threads"
+    };
+
+    int failures = 0;
+
+    void check(bool passed, Mode mode, const char* description) {
+      if (!passed) {
+        fprintf(stderr, "FAIL (%s): %s\n", mode_names[mode], description);
+        failures++;
+      }
+    }
+
+    // Every voice is just an envelope with no attack and full sustain, so
+    // the output is 1 while a note is held and falls once it is released.
+    void createVoice(VoiceHandler* handler, Mode mode) {
+      Envelope* envelope = new Envelope();
+      Value* attack = new Value(0.0);
+      Value* decay = new Value(1.0);
+      Value* sustain = new Value(1.0);
+      Value* release = new Value(RELEASE_SECONDS);
+      envelope->plug(attack, Envelope::kAttack);
+      envelope->plug(decay, Envelope::kDecay);
+      envelope->plug(sustain, Envelope::kSustain);
+      envelope->plug(release, Envelope::kRelease);
+      envelope->plug(handler->voice_event(), Envelope::kTrigger);
+
+      Value* polyphony = new Value(POLYPHONY);
+      handler->plug(polyphony, VoiceHandler::kPolyphony);
+
+      handler->addProcessor(envelope);
+      handler->addGlobalProcessor(attack);
+      handler->addGlobalProcessor(decay);
+      handler->addGlobalProcessor(sustain);
+      handler->addGlobalProcessor(release);
+      handler->addGlobalProcessor(polyphony);
+      handler->setVoiceOutput(envelope->output(Envelope::kValue));
+      handler->setVoiceKiller(envelope);
+
+      handler->setSampleRate(SAMPLE_RATE);
+      handler->setBufferSize(BUFFER_SIZE);
+      if (mode == kVoiceBank)
+        handler->setVoiceBank(true);
+      else if (mode == kVoiceThreads)
+        handler->setVoiceThreads(VOICE_THREADS);
+      handler->createVoices(POLYPHONY);
+    }
+
+    mopo_float peak(const mopo_float* buffer, int start, int end) {
+      mopo_float result = 0.0;
+      for (int i = start; i < end; ++i)
+        result = std::max<mopo_float>(result, fabs(buffer[i]));
+      return result;
+    }
+
+    // A note that ends inside the buffer it starts in still plays through
+    // that buffer and releases in the next one.
+    void testShortNote(Mode mode) {
+      VoiceHandler handler;
+      createVoice(&handler, mode);
+      const mopo_float* output = handler.output()->buffer;
+
+      handler.noteOn(60, 1.0, 0);
+      handler.noteOff(60, SHORT_NOTE_SAMPLES);
+      handler.process();
+      check(peak(output, 0, BUFFER_SIZE) == 1.0, mode,
+            "a note shorter than a buffer doesn't play");
+      check(output[BUFFER_SIZE - 1] == 1.0, mode,
+            "a note shorter than a buffer is cut off early");
+
+      handler.process();
+      check(output[BUFFER_SIZE - 1] < output[0], mode,
+            "a note shorter than a buffer never releases");
+
+      for (int i = 0; i < TAIL_BUFFERS; ++i)
+        handler.process();
+      check(peak(output, 0, BUFFER_SIZE) == 0.0, mode,
+            "a note shorter than a buffer never finishes");
+    }
+
+    // Notes start and stop on the sample they were given.
+    void testNoteOffsets(Mode mode) {
+      VoiceHandler handler;
+      createVoice(&handler, mode);
+      const mopo_float* output = handler.output()->buffer;
+
+      handler.noteOn(60, 1.0, SHORT_NOTE_SAMPLES);
+      handler.process();
+      check(peak(output, 0, SHORT_NOTE_SAMPLES) == 0.0, mode,
+            "a note starts before its offset");
+      check(peak(output, SHORT_NOTE_SAMPLES, BUFFER_SIZE) == 1.0, mode,
+            "a note doesn't start at its offset");
+
+      handler.noteOff(60, NOTE_OFF_SAMPLE);
+      handler.process();
+      check(output[NOTE_OFF_SAMPLE - 1] == 1.0, mode,
+            "a note releases before its offset");
+      check(output[NOTE_OFF_SAMPLE + 1] < 1.0, mode,
+            "a note doesn't release at its offset");
+    }
+  } // namespace
+} // namespace mopo
+
+int main() {
+  for (int mode = 0; mode < mopo::kNumModes; ++mode) {
+    mopo::testShortNote(static_cast<mopo::Mode>(mode));
+    mopo::testNoteOffsets(static_cast<mopo::Mode>(mode));
+  }
+
+  if (mopo::failures) {
+    fprintf(stderr, "%d checks failed\n", mopo::failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
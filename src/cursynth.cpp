@@ -17,6 +17,8 @@
 #include "cursynth.h"
 
 #include "cJSON.h"
+#include "cursynth_patch.h"
+#include "denormals.h"
 
 #include <cstdio>
 #include <cstdlib>
@@ -27,6 +29,7 @@
 #include <sstream>
 #include <string>
 #include <sys/stat.h>
+#include <time.h>
 
 #define KEYBOARD "awsedftgyhujkolp;'"
 #define SLIDER "`1234567890"
@@ -39,15 +42,36 @@
 #define PITCH_BEND_PORT 224
 #define SUSTAIN_PORT 176
 #define SUSTAIN_ID 64
+#define COMMAND_QUEUE_SIZE 1024
+#define MAX_MIDI_LATENCY 0.01
+
+// The stream format has to match the synth's sample type.
+#ifdef MOPO_FLOAT
+#define AUDIO_FORMAT RTAUDIO_FLOAT32
+#else
+#define AUDIO_FORMAT RTAUDIO_FLOAT64
+#endif
 
 namespace {
 
+  // Whether a waiting off that holds _off_ comes before the queued command
+  // number _applied_.
+  bool isDue(unsigned int off, unsigned int applied) {
+    return off && static_cast<int>(applied - (off - 1)) >= 0;
+  }
+
+  double currentSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+  }
+
   // Receive MIDI data and send it to the synth.
   void midiCallback(double delta_time, std::vector<unsigned char>* message,
                     void* user_data) {
-    UNUSED(delta_time);
-    mopo::Cursynth* cursynth = static_cast<mopo::Cursynth*>(user_data);
-    cursynth->processMidi(message);
+    mopo::Cursynth::MidiInput* input =
+        static_cast<mopo::Cursynth::MidiInput*>(user_data);
+    input->cursynth->processMidi(message, delta_time, input);
   }
 
   // Receive audio buffers and send them to the synth.
@@ -111,14 +135,19 @@ namespace {
 } // namespace
 
 namespace mopo {
-  Cursynth::Cursynth() : state_(STANDARD), patch_load_index_(0) {
+  Cursynth::Cursynth() : sample_rate_(0), last_callback_time_(0.0),
+                         ui_commands_(COMMAND_QUEUE_SIZE),
+                         control_changes_(synth_.getControls().size()),
+                         dropped_commands_(0), state_(STANDARD),
+                         patch_load_index_(0) {
     pthread_mutex_init(&mutex_, 0);
   }
 
   void Cursynth::start(unsigned sample_rate, unsigned buffer_size) {
-    // Setup all callbacks.
-    setupAudio(sample_rate, buffer_size);
+    // Setup all callbacks. The MIDI queues have to exist before the audio
+    // callback starts reading them.
     setupMidi();
+    setupAudio(sample_rate, buffer_size);
     setupGui();
     loadConfiguration();
 
@@ -251,10 +280,12 @@ namespace mopo {
         break;
       case KEY_RIGHT:
         control->increment();
+        postControl(control);
         should_redraw_control = true;
         break;
       case KEY_LEFT:
         control->decrement();
+        postControl(control);
         should_redraw_control = true;
         break;
       case KEY_RESIZE:
@@ -266,6 +297,7 @@ namespace mopo {
         for (size_t i = 0; i <= slider_size; ++i) {
           if (SLIDER[i] == key) {
             control->setPercentage((1.0 * i) / slider_size);
+            postControl(control);
             should_redraw_control = true;
             break;
           }
@@ -274,7 +306,8 @@ namespace mopo {
         // Check if they pressed note keys and play the corresponding note.
         for (size_t i = 0; i < strlen(KEYBOARD); ++i) {
           if (KEYBOARD[i] == key) {
-            synth_.noteOn(48 + i);
+            postCommand(&ui_commands_, currentSeconds(),
+                        SynthCommand::kNoteOn, 48 + i, 1.0);
             break;
           }
         }
@@ -316,28 +349,34 @@ namespace mopo {
 
     unsigned actual_sample_rate = chooseSampleRate(device_info, sample_rate);
     synth_.setSampleRate(actual_sample_rate);
+    sample_rate_ = actual_sample_rate;
     buffer_size = CLAMP(buffer_size, 0, mopo::MAX_BUFFER_SIZE);
 
-    // Start the audio callbacks.
+    // Start the audio callbacks once we know the buffer size.
     try {
-      dac_.openStream(&parameters, NULL, RTAUDIO_FLOAT64, actual_sample_rate,
+      dac_.openStream(&parameters, NULL, AUDIO_FORMAT, actual_sample_rate,
                       &buffer_size, &audioCallback, (void*)this);
+      synth_.setBufferSize(buffer_size);
+      synth_.createVoicesInBackground();
+      last_callback_time_ = currentSeconds();
       dac_.startStream();
     }
     catch (RtError& error) {
       error.printMessage();
       exit(0);
     }
-
-    synth_.setBufferSize(buffer_size);
   }
 
   void Cursynth::setupGui() {
     gui_.start();
 
-    // Add the controls to the GUI for viewing.
+    // Add the controls to the GUI for viewing. From now on control changes
+    // go through the audio thread.
     controls_ = synth_.getControls();
     gui_.addControls(controls_);
+    control_map::iterator iter = controls_.begin();
+    for (; iter != controls_.end(); ++iter)
+      iter->second->setDeferred(true);
 
     // Make sure we are drawing he current control.
     Control* control = controls_.at(gui_.getCurrentControl());
@@ -357,10 +396,25 @@ namespace mopo {
   }
 
   void Cursynth::processAudio(mopo_float *out_buffer, unsigned int n_frames) {
-    // Run the synth.
-    lock();
+    // The audio thread belongs to the audio API so we only flush denormals
+    // while we're in here. Voice threads pick the mode up from us.
+    ScopedFlushDenormals flush_denormals;
+
+    // Apply what came in since the last callback and run the synth. Commands
+    // wait while voices are still being created so they can't change the
+    // voice graph under the voice thread.
+    double block_start = last_callback_time_;
+    last_callback_time_ = currentSeconds();
+    if (!synth_.creatingVoices()) {
+      Control* control;
+      while (control_changes_.pop(&control))
+        control->applyPosted();
+
+      processCommands(&ui_commands_, block_start, n_frames);
+      for (size_t i = 0; i < midi_commands_.size(); ++i)
+        processCommands(midi_commands_[i], block_start, n_frames);
+    }
     synth_.process();
-    unlock();
 
     // Copy the synth output to the output buffer.
     const mopo_float* buffer = synth_.output()->buffer;
@@ -377,25 +431,141 @@ namespace mopo {
     }
   }
 
+  void Cursynth::postCommand(CommandQueue* commands, double time,
+                             SynthCommand::Type type,
+                             mopo_float note, mopo_float value) {
+    SynthCommand command;
+    command.time = time;
+    command.type = type;
+    command.note = note;
+    command.value = value;
+
+    // An on can't overtake the off still waiting for it, so it's dropped like
+    // on a full queue. Later offs are covered by the waiting one.
+    int note_index = note;
+    unsigned int* waiting_off = 0;
+    if (type == SynthCommand::kNoteOn || type == SynthCommand::kNoteOff)
+      waiting_off = &commands->note_offs[note_index];
+    else if (type == SynthCommand::kSustainOn ||
+             type == SynthCommand::kSustainOff)
+      waiting_off = &commands->sustain_off;
+
+    if (waiting_off && __atomic_load_n(waiting_off, __ATOMIC_RELAXED)) {
+      if (type == SynthCommand::kNoteOn || type == SynthCommand::kSustainOn)
+        __atomic_fetch_add(&dropped_commands_, 1, __ATOMIC_RELAXED);
+      return;
+    }
+
+    // Waiting would stall the MIDI callback and hold our lock.
+    if (commands->commands.push(command)) {
+      commands->posted++;
+      return;
+    }
+
+    if (type == SynthCommand::kNoteOff || type == SynthCommand::kSustainOff) {
+      __atomic_store_n(waiting_off, commands->posted + 1, __ATOMIC_RELEASE);
+      __atomic_fetch_add(&commands->waiting_offs, 1, __ATOMIC_RELEASE);
+      return;
+    }
+
+    __atomic_fetch_add(&dropped_commands_, 1, __ATOMIC_RELAXED);
+  }
+
+  void Cursynth::applyWaitingOffs(CommandQueue* commands) {
+    if (__atomic_load_n(&commands->waiting_offs, __ATOMIC_ACQUIRE) == 0)
+      return;
+
+    // They are late already, so they go at the start of the block.
+    for (int i = 0; i < MIDI_SIZE; ++i) {
+      unsigned int off = __atomic_load_n(&commands->note_offs[i],
+                                         __ATOMIC_ACQUIRE);
+      if (isDue(off, commands->applied)) {
+        synth_.noteOff(i);
+        __atomic_store_n(&commands->note_offs[i], 0, __ATOMIC_RELEASE);
+        __atomic_fetch_sub(&commands->waiting_offs, 1, __ATOMIC_RELEASE);
+      }
+    }
+
+    unsigned int off = __atomic_load_n(&commands->sustain_off,
+                                       __ATOMIC_ACQUIRE);
+    if (isDue(off, commands->applied)) {
+      synth_.sustainOff();
+      __atomic_store_n(&commands->sustain_off, 0, __ATOMIC_RELEASE);
+      __atomic_fetch_sub(&commands->waiting_offs, 1, __ATOMIC_RELEASE);
+    }
+  }
+
+  void Cursynth::processCommands(CommandQueue* commands, double block_start,
+                                 unsigned int n_frames) {
+    SynthCommand command;
+    while (commands->commands.pop(&command)) {
+      applyWaitingOffs(commands);
+      commands->applied++;
+
+      // Wheels still change at the start of the block.
+      mopo_float offset = (command.time - block_start) * sample_rate_;
+      int sample = CLAMP(offset, 0, n_frames - 1.0);
+
+      switch (command.type) {
+        case SynthCommand::kNoteOn:
+          synth_.noteOn(command.note, command.value, sample);
+          break;
+        case SynthCommand::kNoteOff:
+          synth_.noteOff(command.note, sample);
+          break;
+        case SynthCommand::kSustainOn:
+          synth_.sustainOn();
+          break;
+        case SynthCommand::kSustainOff:
+          synth_.sustainOff(sample);
+          break;
+        case SynthCommand::kModWheel:
+          synth_.setModWheel(command.value);
+          break;
+        case SynthCommand::kPitchWheel:
+          synth_.setPitchWheel(command.value);
+          break;
+      }
+    }
+    applyWaitingOffs(commands);
+  }
+
   void Cursynth::setupMidi() {
     RtMidiIn* midi_in = new RtMidiIn();
     if (midi_in->getPortCount() <= 0) {
       std::cout << "No midi devices found.\n";
     }
 
-    // Setup MIDI callbacks for every MIDI device.
+    // Setup MIDI callbacks for every MIDI device, each with its own queue.
     // TODO: Have a menu for only enabling some MIDI devices.
     for (unsigned int i = 0; i < midi_in->getPortCount(); ++i) {
+      MidiInput* input = new MidiInput();
+      input->cursynth = this;
+      input->commands = new CommandQueue(COMMAND_QUEUE_SIZE);
+      input->time = 0.0;
+      midi_inputs_.push_back(input);
+      midi_commands_.push_back(input->commands);
+
       RtMidiIn* device = new RtMidiIn();
       device->openPort(i);
-      device->setCallback(&midiCallback, (void*)this);
+      device->setCallback(&midiCallback, (void*)input);
       midi_ins_.push_back(device);
     }
 
     delete midi_in;
   }
 
-  void Cursynth::processMidi(std::vector<unsigned char>* message) {
+  void Cursynth::processMidi(std::vector<unsigned char>* message,
+                             double delta_time, MidiInput* input) {
+    // The device's deltas keep the spacing between messages even when they
+    // reach us in bursts. Follow them unless they drift from our clock.
+    double now = currentSeconds();
+    input->time += delta_time;
+    if (input->time > now || input->time < now - MAX_MIDI_LATENCY)
+      input->time = now;
+    double time = input->time;
+    CommandQueue* commands = input->commands;
+
     if (message->size() < 3)
       return;
 
@@ -410,23 +580,27 @@ namespace mopo {
       int midi_note = midi_id;
       int midi_velocity = midi_val;
 
-      if (midi_velocity)
-        synth_.noteOn(midi_note, (1.0 * midi_velocity) / MIDI_SIZE);
+      if (midi_velocity) {
+        postCommand(commands, time, SynthCommand::kNoteOn, midi_note,
+                    (1.0 * midi_velocity) / MIDI_SIZE);
+      }
       else
-        synth_.noteOff(midi_note);
+        postCommand(commands, time, SynthCommand::kNoteOff, midi_note);
     }
     else if (midi_port >= 128 && midi_port < 144) {
       // A MIDI keyboard key was released. Release that note.
       int midi_note = midi_id;
-      synth_.noteOff(midi_note);
+      postCommand(commands, time, SynthCommand::kNoteOff, midi_note);
+    }
+    else if (midi_port == PITCH_BEND_PORT) {
+      postCommand(commands, time, SynthCommand::kPitchWheel, 0.0,
+                  (2.0 * midi_val) / (MIDI_SIZE - 1) - 1);
     }
-    else if (midi_port == PITCH_BEND_PORT)
-      synth_.setPitchWheel((2.0 * midi_val) / (MIDI_SIZE - 1) - 1);
     else if (midi_port == SUSTAIN_PORT && midi_id == SUSTAIN_ID) {
       if (midi_val)
-        synth_.sustainOn();
+        postCommand(commands, time, SynthCommand::kSustainOn);
       else
-        synth_.sustainOff();
+        postCommand(commands, time, SynthCommand::kSustainOff);
     }
     else if (midi_port < 254) {
       // Must have gotten MIDI from some knob or other control.
@@ -444,12 +618,14 @@ namespace mopo {
         // MIDI learn is enabled for this control. Change the paired control.
         Control* midi_control = controls_.at(midi_learn_[midi_id]);
         midi_control->setMidi(midi_val);
+        postControl(midi_control);
         gui_.drawControl(midi_control, selected_control == midi_control);
         gui_.drawControlStatus(midi_control, false);
       }
 
       if (midi_id == MOD_WHEEL_ID)
-        synth_.setModWheel(midi_val);
+        postCommand(commands, time, SynthCommand::kModWheel, 0.0,
+                    midi_val / (MIDI_SIZE - 1.0));
     }
     unlock();
   }
@@ -457,6 +633,10 @@ namespace mopo {
   void Cursynth::stop() {
     pthread_mutex_destroy(&mutex_);
     gui_.stop();
+    unsigned int dropped = __atomic_load_n(&dropped_commands_,
+                                           __ATOMIC_RELAXED);
+    if (dropped)
+      std::cerr << "Dropped " << dropped << " input events.\n";
     try {
       dac_.stopStream();
     }
@@ -584,7 +764,8 @@ namespace mopo {
     cJSON* root = cJSON_CreateObject();
     control_map::iterator iter = controls_.begin();
     for (; iter != controls_.end(); ++iter) {
-      cJSON* value = cJSON_CreateNumber(iter->second->value()->value());
+      // The audio thread may not have applied the latest values yet.
+      cJSON* value = cJSON_CreateNumber(iter->second->current_value());
       cJSON_AddItemToObject(root, iter->first.c_str(), value);
     }
 
@@ -598,24 +779,17 @@ namespace mopo {
   }
 
   void Cursynth::readStateFromString(const std::string& state) {
-    // Parse state into JSON and read all controls.
-    cJSON* root = cJSON_Parse(state.c_str());
+    readPatchState(controls_, state);
+
     control_map::iterator iter = controls_.begin();
     for (; iter != controls_.end(); ++iter) {
-      cJSON* value = cJSON_GetObjectItem(root, iter->first.c_str());
-
-      if (value) {
-        Control* control = iter->second;
-        control->set(value->valuedouble);
-        gui_.drawControl(control, false);
-      }
+      postControl(iter->second);
+      gui_.drawControl(iter->second, false);
     }
 
     // Setup current control.
     Control* current_control = controls_.at(gui_.getCurrentControl());
     gui_.drawControl(current_control, true);
     gui_.drawControlStatus(current_control, false);
-
-    cJSON_Delete(root);
   }
 } // namespace mopo
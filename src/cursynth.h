@@ -22,11 +22,50 @@
 #include "RtMidi.h"
 #include "cursynth_gui.h"
 #include "cursynth_engine.h"
+#include "spsc_queue.h"
 
 #include <pthread.h>
 
 namespace mopo {
 
+  // A change to the synth an input thread posts for the audio thread. _time_
+  // is when it happened in seconds on the monotonic clock.
+  struct SynthCommand {
+    enum Type {
+      kNoteOn,
+      kNoteOff,
+      kSustainOn,
+      kSustainOff,
+      kModWheel,
+      kPitchWheel,
+    };
+
+    double time;
+    Type type;
+    mopo_float note;
+    mopo_float value;
+  };
+
+  // The commands from one input thread. Note-offs and sustain-offs that
+  // don't fit in _commands_ wait in _note_offs_ and _sustain_off_ instead,
+  // or notes would hang. They hold one more than the number of commands
+  // posted before them, 0 if nothing waits, so the audio thread applies them
+  // in order.
+  struct CommandQueue {
+    CommandQueue(int capacity) : commands(capacity), posted(0), applied(0),
+                                 sustain_off(0), waiting_offs(0) {
+      for (int i = 0; i < MIDI_SIZE; ++i)
+        note_offs[i] = 0;
+    }
+
+    SpscQueue<SynthCommand> commands;
+    unsigned int posted;
+    unsigned int applied;
+    unsigned int note_offs[MIDI_SIZE];
+    unsigned int sustain_off;
+    int waiting_offs;
+  };
+
   class Cursynth {
     public:
       // Computer keyboard reading states.
@@ -37,21 +76,42 @@ namespace mopo {
         PATCH_SAVING,
       };
 
+      // A MIDI device's callback data. Each device gets its own queue.
+      // _time_ is when the device's last message happened.
+      struct MidiInput {
+        Cursynth* cursynth;
+        CommandQueue* commands;
+        double time;
+      };
+
       Cursynth();
 
       // Start/stop everything - UI, synth engine, input/output.
       void start(unsigned sample_rate, unsigned buffer_size);
       void stop();
 
-      // Runs the synth engine for _n_frames_ samples and copies the output
-      // to _out_buffer_.
+      // Applies the commands the input threads posted, runs the synth engine
+      // for _n_frames_ samples and copies the output to _out_buffer_. Never
+      // blocks. Notes land on the sample matching when they happened during
+      // the last callback period, so they are all late by the same amount.
       void processAudio(mopo_float *out_buffer, unsigned int n_frames);
 
-      // Processes MIDI data like note and velocity, and knob data.
-      void processMidi(std::vector<unsigned char>* message);
+      // Switches the engine between per voice and voice bank rendering.
+      void setVoiceBank(bool voice_bank) { synth_.setVoiceBank(voice_bank); }
 
-      // If we're working with the synth or UI, lock so we don't break
-      // something. Then unlock when we're done.
+      // Spreads voice rendering over _num_threads_ threads.
+      void setVoiceThreads(int num_threads) {
+        synth_.setVoiceThreads(num_threads);
+      }
+
+      // Processes MIDI data like note and velocity, and knob data. Changes to
+      // the synth are posted to _input_'s queue. _delta_time_ is the seconds
+      // since the device's previous message.
+      void processMidi(std::vector<unsigned char>* message,
+                       double delta_time, MidiInput* input);
+
+      // The input threads lock so they don't change the UI at the same time.
+      // The audio thread never locks.
       void lock() { pthread_mutex_lock(&mutex_); }
       void unlock() { pthread_mutex_unlock(&mutex_); }
 
@@ -96,15 +156,51 @@ namespace mopo {
       // Helper function to erase all evidence of MIDI learn for a control.
       void eraseMidiLearn(Control* control);
 
+      // Posts a command that happened at _time_ for the audio thread. Never
+      // waits. Note-offs and sustain-offs always get through, anything else
+      // is dropped and counted if the queue is full.
+      void postCommand(CommandQueue* commands, double time,
+                       SynthCommand::Type type,
+                       mopo_float note = 0.0, mopo_float value = 0.0);
+
+      // Posts _control_'s current value for the audio thread. Only the latest
+      // value is applied, so a control is queued at most once and changes
+      // are never dropped. Call with the lock held.
+      void postControl(Control* control) {
+        if (!control->post(control->current_value()))
+          control_changes_.push(control);
+      }
+
+      // Audio thread only. Commands that happened after _block_start_ are
+      // placed that far into the next _n_frames_ samples.
+      void processCommands(CommandQueue* commands, double block_start,
+                           unsigned int n_frames);
+
+      // Audio thread only. Applies the waiting offs that came before the
+      // next queued command.
+      void applyWaitingOffs(CommandQueue* commands);
+
       // Cursynth parts.
       CursynthEngine synth_;
       CursynthGui gui_;
 
       // IO.
       RtAudio dac_;
+      unsigned sample_rate_;
+      double last_callback_time_;
       std::vector<RtMidiIn*> midi_ins_;
+      std::vector<MidiInput*> midi_inputs_;
       std::map<int, std::string> midi_learn_;
 
+      // Commands from the computer keyboard and from each MIDI device, and
+      // the controls with a value waiting, which fit all the controls.
+      CommandQueue ui_commands_;
+      SpscQueue<Control*> control_changes_;
+      std::vector<CommandQueue*> midi_commands_;
+
+      // Commands lost to full queues, counted from every input thread.
+      unsigned int dropped_commands_;
+
       // State.
       InputState state_;
       control_map controls_;
@@ -0,0 +1,486 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * cursynth is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cursynth is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cursynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Plays the same chord and arpeggio through every patch at a few polyphonies
+// and writes block timing as JSON, one result per line so runs from different
+// commits diff cleanly. Samples are processed with denormals flushed unless
+// --keep-denormals is passed. Configured with --enable-denormal-counter the
+// results also count the subnormal samples each kind of processor output.
+// Before the patches it times how long the program takes to start and how
+// long a new engine takes to get through its first block, and measures the
+// heap the engine and each of its voices take.
+
+#include "cursynth_engine.h"
+#include "cursynth_patch.h"
+#include "denormals.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <dirent.h>
+#include <fstream>
+#include <getopt.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <time.h>
+#include <typeinfo>
+#include <unistd.h>
+#include <vector>
+
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
+#define EXTENSION ".mite"
+#define NUM_HISTOGRAM_BUCKETS 18
+#define STARTUP_RUNS 21
+#define WARMUP_BLOCKS 16
+
+// The workload. A chord is held while a sixteenth note arpeggio climbs over
+// it with the sustain pedal down, so voices pile up until they get stolen.
+// Then everything is released and we render the release tails.
+#define ARPEGGIO_NOTE_SECONDS 0.125
+#define ARPEGGIO_NOTE_LENGTH 0.1
+#define ARPEGGIO_NOTES 32
+#define RELEASE_SECONDS 2.0
+
+namespace {
+
+  const int polyphonies[] = { 1, 8, 32, 64 };
+  const int chord[] = { 48, 52, 55, 59 };
+  const int arpeggio[] = { 60, 64, 67, 71, 72, 76, 79, 83 };
+
+  struct BenchEvent {
+    int sample;
+    int note;
+    bool on;
+  };
+
+  bool compareBenchEvents(const BenchEvent& left, const BenchEvent& right) {
+    return left.sample < right.sample;
+  }
+
+  double currentSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+  }
+
+  // Returns all the patch files in _dir_ in alphabetical order.
+  std::vector<std::string> getPatches(const std::string& dir) {
+    std::vector<std::string> file_names;
+    DIR *directory = NULL;
+    struct dirent *ent = NULL;
+
+    if ((directory = opendir(dir.c_str())) != NULL) {
+      while ((ent = readdir(directory)) != NULL) {
+        std::string name = ent->d_name;
+        if (name.find(EXTENSION) != std::string::npos)
+          file_names.push_back(name);
+      }
+      closedir(directory);
+    }
+
+    std::sort(file_names.begin(), file_names.end());
+    return file_names;
+  }
+
+  std::vector<BenchEvent> createWorkload(int sample_rate) {
+    std::vector<BenchEvent> events;
+    int num_chord_notes = sizeof(chord) / sizeof(chord[0]);
+    int num_arpeggio_notes = sizeof(arpeggio) / sizeof(arpeggio[0]);
+    int end = ARPEGGIO_NOTES * ARPEGGIO_NOTE_SECONDS * sample_rate;
+
+    for (int i = 0; i < num_chord_notes; ++i) {
+      BenchEvent on = { 0, chord[i], true };
+      BenchEvent off = { end, chord[i], false };
+      events.push_back(on);
+      events.push_back(off);
+    }
+
+    for (int i = 0; i < ARPEGGIO_NOTES; ++i) {
+      int note = arpeggio[i % num_arpeggio_notes];
+      int start = i * ARPEGGIO_NOTE_SECONDS * sample_rate;
+      int stop = start + ARPEGGIO_NOTE_LENGTH * sample_rate;
+      BenchEvent on = { start, note, true };
+      BenchEvent off = { stop, note, false };
+      events.push_back(on);
+      events.push_back(off);
+    }
+
+    std::stable_sort(events.begin(), events.end(), compareBenchEvents);
+    return events;
+  }
+
+  // Times running _program_ with --exit, which returns as soon as main starts,
+  // so it's how long loading and static initialization take. Returns the
+  // median run or a negative number if the program couldn't be run.
+  double processStartupSeconds(const char* program) {
+    std::vector<double> seconds;
+    for (int i = 0; i < STARTUP_RUNS; ++i) {
+      double start = currentSeconds();
+      pid_t child = fork();
+      if (child == 0) {
+        execlp(program, program, "--exit", (char*)0);
+        _exit(EXIT_FAILURE);
+      }
+
+      int status = 0;
+      if (child < 0 || waitpid(child, &status, 0) != child ||
+          !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        return -1.0;
+      }
+      seconds.push_back(currentSeconds() - start);
+    }
+
+    std::sort(seconds.begin(), seconds.end());
+    return seconds[STARTUP_RUNS / 2];
+  }
+
+  // Bytes of heap in use, or -1 if the C library can't tell us.
+  long long heapBytes() {
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return -1;
+#endif
+  }
+
+  mopo::CursynthEngine* createEngineWithoutVoices(int sample_rate,
+                                                  int buffer_size,
+                                                  bool voice_bank,
+                                                  int voice_threads) {
+    mopo::CursynthEngine* synth = new mopo::CursynthEngine();
+    synth->setSampleRate(sample_rate);
+    synth->setBufferSize(buffer_size);
+    synth->setVoiceBank(voice_bank);
+    synth->setVoiceThreads(voice_threads);
+    return synth;
+  }
+
+  mopo::CursynthEngine* createEngine(int sample_rate, int buffer_size,
+                                     bool voice_bank, int voice_threads) {
+    mopo::CursynthEngine* synth =
+        createEngineWithoutVoices(sample_rate, buffer_size,
+                                  voice_bank, voice_threads);
+    synth->createVoices();
+    return synth;
+  }
+
+  // Measures the heap a new engine takes once it has processed a block, and
+  // the part of that each of its MAX_POLYPHONY voices takes. Both are -1 if
+  // the heap can't be measured.
+  void measureHeap(int sample_rate, int buffer_size,
+                   bool voice_bank, int voice_threads,
+                   long long* engine_bytes, long long* voice_bytes) {
+    long long start = heapBytes();
+    mopo::CursynthEngine* synth =
+        createEngineWithoutVoices(sample_rate, buffer_size,
+                                  voice_bank, voice_threads);
+    long long without_voices = heapBytes();
+    synth->createVoices();
+    synth->process();
+    long long end = heapBytes();
+    delete synth;
+
+    if (start < 0) {
+      *engine_bytes = -1;
+      *voice_bytes = -1;
+    }
+    else {
+      *engine_bytes = end - start;
+      *voice_bytes = (end - without_voices) / MAX_POLYPHONY;
+    }
+  }
+
+  struct BenchResult {
+    std::vector<double> block_seconds;
+    double total_seconds;
+    std::map<std::string, unsigned long long> subnormals;
+  };
+
+#ifdef MOPO_COUNT_DENORMALS
+  std::string processorName(const mopo::Processor* processor) {
+    const char* mangled = typeid(*processor).name();
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(mangled, 0, 0, &status);
+    std::string name = status == 0 ? demangled : mangled;
+    free(demangled);
+    return name;
+  }
+
+  // Adds up the subnormal samples of the processors of each type.
+  void countSubnormals(const mopo::CursynthEngine* synth,
+                       BenchResult* result) {
+    mopo::Processor::SubnormalCounts counts;
+    synth->collectSubnormals(synth, &counts);
+
+    mopo::Processor::SubnormalCounts::iterator iter;
+    for (iter = counts.begin(); iter != counts.end(); ++iter) {
+      if (iter->second)
+        result->subnormals[processorName(iter->first)] += iter->second;
+    }
+  }
+#endif
+
+  BenchResult runWorkload(mopo::CursynthEngine* synth,
+                          const std::vector<BenchEvent>& events,
+                          int sample_rate, int buffer_size) {
+    int sustain_end = ARPEGGIO_NOTES * ARPEGGIO_NOTE_SECONDS * sample_rate;
+    int end = sustain_end + RELEASE_SECONDS * sample_rate;
+
+    BenchResult result;
+    result.total_seconds = 0.0;
+    synth->sustainOn();
+
+    size_t event_index = 0;
+    for (int sample = 0; sample < end; sample += buffer_size) {
+      double start = currentSeconds();
+
+      // Events land at the start of the buffer they fall in.
+      while (event_index < events.size() &&
+             events[event_index].sample < sample + buffer_size) {
+        const BenchEvent& event = events[event_index++];
+        if (event.on)
+          synth->noteOn(event.note, 0.8);
+        else
+          synth->noteOff(event.note);
+      }
+      if (sustain_end >= sample && sustain_end < sample + buffer_size)
+        synth->sustainOff();
+
+      synth->process();
+
+      double block_seconds = currentSeconds() - start;
+      result.block_seconds.push_back(block_seconds);
+      result.total_seconds += block_seconds;
+    }
+    return result;
+  }
+
+  void writeResult(FILE* output, const std::string& patch, int polyphony,
+                   const BenchResult& result, bool first) {
+    std::vector<double> sorted = result.block_seconds;
+    std::sort(sorted.begin(), sorted.end());
+    int num_blocks = sorted.size();
+    int p99_index = std::max(0, (99 * num_blocks + 99) / 100 - 1);
+
+    // Buckets are powers of two microseconds, the last one holds the rest.
+    int histogram[NUM_HISTOGRAM_BUCKETS] = { 0 };
+    for (int i = 0; i < num_blocks; ++i) {
+      int bucket = 0;
+      double limit = 1e-6;
+      while (bucket < NUM_HISTOGRAM_BUCKETS - 1 && sorted[i] > limit) {
+        bucket++;
+        limit *= 2.0;
+      }
+      histogram[bucket]++;
+    }
+
+    fprintf(output, "%s    {\"patch\": \"%s\", \"polyphony\": %d, "
+                    "\"blocks\": %d, \"blocks_per_second\": %.1f, "
+                    "\"mean_us\": %.3f, \"p99_us\": %.3f, \"worst_us\": %.3f, "
+                    "\"histogram\": [",
+            first ? "" : ",\n", patch.c_str(), polyphony, num_blocks,
+            num_blocks / result.total_seconds,
+            1e6 * result.total_seconds / num_blocks,
+            1e6 * sorted[p99_index], 1e6 * sorted.back());
+    for (int i = 0; i < NUM_HISTOGRAM_BUCKETS; ++i)
+      fprintf(output, "%s%d", i ? ", " : "", histogram[i]);
+    fprintf(output, "]");
+
+#ifdef MOPO_COUNT_DENORMALS
+    fprintf(output, ", \"subnormals\": {");
+    std::map<std::string, unsigned long long>::const_iterator iter;
+    for (iter = result.subnormals.begin(); iter != result.subnormals.end();
+         ++iter) {
+      fprintf(output, "%s\"%s\": %llu",
+              iter == result.subnormals.begin() ? "" : ", ",
+              iter->first.c_str(), iter->second);
+    }
+    fprintf(output, "}");
+#endif
+    fprintf(output, "}");
+  }
+} // namespace
+
+int main(int argc, char** argv) {
+  std::string patches_directory = SOURCE_PATCHES_DIRECTORY;
+  const char* output_name = 0;
+  int sample_rate = mopo::DEFAULT_SAMPLE_RATE;
+  int buffer_size = mopo::DEFAULT_BUFFER_SIZE;
+  bool voice_bank = false;
+  int voice_threads = 1;
+  bool flush_denormals = true;
+
+  int getopt_response = 0;
+  while (getopt_response != -1) {
+    static const struct option long_options[] = {
+      {"patches", required_argument, 0, 'p'},
+      {"output", required_argument, 0, 'o'},
+      {"sample-rate", required_argument, 0, 's'},
+      {"buffer-size", required_argument, 0, 'b'},
+      {"voice-bank", no_argument, 0, 'k'},
+      {"voice-threads", required_argument, 0, 't'},
+      {"keep-denormals", no_argument, 0, 'd'},
+      {"exit", no_argument, 0, 'x'},
+      {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    getopt_response = getopt_long(argc, argv, "p:o:s:b:kt:dx",
+                                  long_options, &option_index);
+
+    switch (getopt_response) {
+      case 'p':
+        patches_directory = optarg;
+        break;
+      case 'o':
+        output_name = optarg;
+        break;
+      case 's':
+        sample_rate = atoi(optarg);
+        break;
+      case 'b':
+        buffer_size = CLAMP(atoi(optarg), 1, mopo::MAX_BUFFER_SIZE);
+        break;
+      case 'k':
+        voice_bank = true;
+        break;
+      case 't':
+        voice_threads = atoi(optarg);
+        break;
+      case 'd':
+        flush_denormals = false;
+        break;
+      case 'x':
+        // Only used to time startup.
+        exit(EXIT_SUCCESS);
+      case -1:
+        break;
+      default:
+        fprintf(stderr,
+                "Usage: cursynth_bench [--patches OR -p patch-directory]\n"
+                "                      [--output OR -o results.json]\n"
+                "                      [--sample-rate OR -s sample-rate]\n"
+                "                      [--buffer-size OR -b buffer-size]\n"
+                "                      [--voice-bank OR -k]\n"
+                "                      [--voice-threads OR -t threads]\n"
+                "                      [--keep-denormals OR -d]\n");
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  std::vector<std::string> patches = getPatches(patches_directory);
+  if (patches.empty()) {
+    fprintf(stderr, "No patches found in %s\n", patches_directory.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  FILE* output = output_name ? fopen(output_name, "w") : stdout;
+  if (output == 0) {
+    fprintf(stderr, "Could not open %s\n", output_name);
+    exit(EXIT_FAILURE);
+  }
+
+  // Voice threads pick the mode up from this thread.
+  mopo::setFlushDenormals(flush_denormals);
+
+  double process_startup = processStartupSeconds(argv[0]);
+  double engine_start = currentSeconds();
+  mopo::CursynthEngine* first_engine = createEngine(sample_rate, buffer_size,
+                                                    voice_bank, voice_threads);
+  first_engine->process();
+  double engine_startup = currentSeconds() - engine_start;
+  delete first_engine;
+
+  long long engine_bytes = 0;
+  long long voice_bytes = 0;
+  measureHeap(sample_rate, buffer_size, voice_bank, voice_threads,
+              &engine_bytes, &voice_bytes);
+
+  fprintf(output, "{\n");
+  fprintf(output, "  \"sample_rate\": %d,\n", sample_rate);
+  fprintf(output, "  \"buffer_size\": %d,\n", buffer_size);
+  fprintf(output, "  \"flush_denormals\": %s,\n",
+          mopo::flushingDenormals() ? "true" : "false");
+  if (process_startup < 0.0)
+    fprintf(output, "  \"process_startup_us\": null,\n");
+  else
+    fprintf(output, "  \"process_startup_us\": %.1f,\n",
+            1e6 * process_startup);
+  fprintf(output, "  \"engine_startup_us\": %.1f,\n", 1e6 * engine_startup);
+  if (engine_bytes < 0) {
+    fprintf(output, "  \"engine_heap_bytes\": null,\n");
+    fprintf(output, "  \"voice_heap_bytes\": null,\n");
+  }
+  else {
+    fprintf(output, "  \"engine_heap_bytes\": %lld,\n", engine_bytes);
+    fprintf(output, "  \"voice_heap_bytes\": %lld,\n", voice_bytes);
+  }
+  fprintf(output, "  \"block_budget_us\": %.3f,\n",
+          1e6 * buffer_size / sample_rate);
+  fprintf(output, "  \"histogram_bucket_us\": [");
+  for (int i = 0; i < NUM_HISTOGRAM_BUCKETS - 1; ++i)
+    fprintf(output, "%s%d", i ? ", " : "", 1 << i);
+  fprintf(output, "],\n");
+  fprintf(output, "  \"patches\": [\n");
+
+  std::vector<BenchEvent> events = createWorkload(sample_rate);
+  int num_polyphonies = sizeof(polyphonies) / sizeof(polyphonies[0]);
+  bool first = true;
+  for (size_t p = 0; p < patches.size(); ++p) {
+    std::ifstream file((patches_directory + "/" + patches[p]).c_str());
+    std::stringstream state;
+    state << file.rdbuf();
+
+    std::string name = patches[p].substr(0, patches[p].find(EXTENSION));
+    for (int i = 0; i < num_polyphonies; ++i) {
+      mopo::CursynthEngine* synth = createEngine(sample_rate, buffer_size,
+                                                 voice_bank, voice_threads);
+
+      mopo::control_map controls = synth->getControls();
+      if (!mopo::readPatchState(controls, state.str())) {
+        fprintf(stderr, "Could not parse %s\n", patches[p].c_str());
+        exit(EXIT_FAILURE);
+      }
+
+      controls["polyphony"]->set(polyphonies[i]);
+
+      // Let voices get created and controls settle before timing.
+      for (int b = 0; b < WARMUP_BLOCKS; ++b)
+        synth->process();
+
+      BenchResult result = runWorkload(synth, events,
+                                       sample_rate, buffer_size);
+#ifdef MOPO_COUNT_DENORMALS
+      countSubnormals(synth, &result);
+#endif
+      writeResult(output, name, polyphonies[i], result, first);
+      first = false;
+      delete synth;
+    }
+  }
+
+  fprintf(output, "\n  ]\n}\n");
+  if (output != stdout)
+    fclose(output);
+  return 0;
+}
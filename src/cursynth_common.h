@@ -32,22 +32,48 @@ namespace mopo {
     public:
       Control(Value* value, mopo_float min, mopo_float max, int resolution) :
           value_(value), min_(min), max_(max),
-          resolution_(resolution), midi_learn_(0) {
+          resolution_(resolution), midi_learn_(0), deferred_(false),
+          posted_value_(0), posted_(0) {
         current_value_ = value->value();
+        default_value_ = current_value_;
       }
 
       Control(Value* value, std::vector<std::string> strings, int resolution) :
           value_(value), min_(0), max_(resolution),
-          resolution_(resolution), midi_learn_(0), display_strings_(strings) {
+          resolution_(resolution), midi_learn_(0), deferred_(false),
+          posted_value_(0), posted_(0), display_strings_(strings) {
         current_value_ = value->value();
+        default_value_ = current_value_;
       }
 
       Control() : value_(0), min_(0), max_(0), current_value_(0),
-                  resolution_(0), midi_learn_(0) { }
+                  default_value_(0), resolution_(0), midi_learn_(0), deferred_(false),
+                  posted_value_(0), posted_(0) { }
 
       void set(mopo_float val) {
         current_value_ = CLAMP(val, min_, max_);
-        value_->set(current_value_);
+        if (!deferred_)
+          value_->set(current_value_);
+      }
+
+      // A deferred control only remembers its value. Whoever owns the synth
+      // passes it on with post() and applyPosted(), e.g. to the audio thread.
+      void setDeferred(bool deferred) { deferred_ = deferred; }
+
+      // Input threads. Leaves _val_ for applyPosted() and returns true if an
+      // earlier value is still waiting there, so the audio thread is already
+      // told and only the latest value gets applied.
+      bool post(mopo_float val) {
+        __atomic_store(&posted_value_, &val, __ATOMIC_RELAXED);
+        return __atomic_exchange_n(&posted_, 1, __ATOMIC_ACQ_REL);
+      }
+
+      // Audio thread. Applies the latest posted value.
+      void applyPosted() {
+        __atomic_exchange_n(&posted_, 0, __ATOMIC_ACQ_REL);
+        mopo_float val;
+        __atomic_load(&posted_value_, &val, __ATOMIC_RELAXED);
+        value_->set(val);
       }
 
       mopo_float getPercentage() const {
@@ -63,6 +89,9 @@ namespace mopo {
         setPercentage(midi_val / (MIDI_SIZE - 1.0));
       }
 
+      // Sets the control back to the value it was created with.
+      void reset() { set(default_value_); }
+
       void increment() {
         set(current_value_ + (max_ - min_) / resolution_);
       }
@@ -87,8 +116,11 @@ namespace mopo {
 
     private:
       Value* value_;
-      mopo_float min_, max_, current_value_;
+      mopo_float min_, max_, current_value_, default_value_;
       int resolution_, midi_learn_;
+      bool deferred_;
+      mopo_float posted_value_;
+      int posted_;
       std::vector<std::string> display_strings_;
   };
 
@@ -23,6 +23,7 @@
 #include "oscillator.h"
 #include "processor_router.h"
 #include "linear_slope.h"
+#include "modulation_matrix.h"
 #include "smooth_value.h"
 #include "cursynth_strings.h"
 #include "trigger_operators.h"
@@ -31,6 +32,7 @@
 #include <sstream>
 
 #define PITCH_MOD_RANGE 12
+#define MAX_DELAY_TIME 1.0
 
 namespace mopo {
 
@@ -43,7 +45,7 @@ namespace mopo {
     freq_mod2_ = new Multiply();
     normalized_fm1_ = new Add();
     normalized_fm2_ = new Add();
-    Value* one = new Value(1);
+    one_ = new Value(1);
 
     addProcessor(normalized_fm1_);
     addProcessor(normalized_fm2_);
@@ -65,8 +67,8 @@ namespace mopo {
 
     normalized_fm1_->plug(freq_mod1_, 0);
     normalized_fm2_->plug(freq_mod2_, 0);
-    normalized_fm1_->plug(one, 1);
-    normalized_fm2_->plug(one, 1);
+    normalized_fm1_->plug(one_, 1);
+    normalized_fm2_->plug(one_, 1);
     frequency1_->plug(normalized_fm1_, 1);
     frequency2_->plug(normalized_fm2_, 1);
     oscillator1_->plug(frequency1_, Oscillator::kFrequency);
@@ -79,9 +81,12 @@ namespace mopo {
   }
 
   void CursynthOscillators::process() {
-    int num_feedbacks = feedback_order_->size();
+    if (needsUpdate())
+      updateAllProcessors();
+
+    int num_feedbacks = compiled_feedback_order_.size();
     for (int i = 0; i < num_feedbacks; ++i)
-      feedback_processors_[feedback_order_->at(i)]->tickBeginRefreshOutput();
+      compiled_feedback_order_[i]->tickBeginRefreshOutput();
 
     oscillator1_->preprocess();
     oscillator2_->preprocess();
@@ -89,12 +94,12 @@ namespace mopo {
 
     for (int i = 1; i < buffer_size_; ++i) {
       for (int f = 0; f < num_feedbacks; ++f)
-        feedback_processors_[feedback_order_->at(f)]->tickRefreshOutput(i);
+        compiled_feedback_order_[f]->tickRefreshOutput(i);
 
       tick(i);
 
       for (int f = 0; f < num_feedbacks; ++f)
-        feedback_processors_[feedback_order_->at(f)]->tick(i);
+        compiled_feedback_order_[f]->tick(i);
     }
   }
 
@@ -109,17 +114,18 @@ namespace mopo {
     bent_midi->plug(pitch_bend, 1);
 
     Value* pitch_mod_range = new Value(PITCH_MOD_RANGE);
-    VariableAdd* midi_mod_sources = new VariableAdd(MOD_MATRIX_SIZE);
+    int midi_mod_sources = mod_matrix_->addDestination();
     Multiply* midi_mod = new Multiply();
     midi_mod->plug(pitch_mod_range, 0);
-    midi_mod->plug(midi_mod_sources, 1);
+    midi_mod->plug(mod_matrix_->output(midi_mod_sources), 1);
     Add* final_midi = new Add();
     final_midi->plug(bent_midi, 0);
     final_midi->plug(midi_mod, 1);
 
+    addGlobalProcessor(pitch_bend_range);
     addGlobalProcessor(pitch_bend);
+    addGlobalProcessor(pitch_mod_range);
     addProcessor(bent_midi);
-    addProcessor(midi_mod_sources);
     addProcessor(midi_mod);
     addProcessor(final_midi);
 
@@ -136,15 +142,16 @@ namespace mopo {
     oscillators_->plug(oscillator1_frequency, 4);
 
     Value* cross_mod = new Value(0.15);
-    VariableAdd* cross_mod_mod_sources = new VariableAdd(MOD_MATRIX_SIZE);
+    int cross_mod_mod_sources = mod_matrix_->addDestination();
     Add* cross_mod_total = new Add();
     cross_mod_total->plug(cross_mod, 0);
-    cross_mod_total->plug(cross_mod_mod_sources, 1);
+    cross_mod_total->plug(mod_matrix_->output(cross_mod_mod_sources), 1);
 
     oscillators_->plug(cross_mod_total, 6);
     oscillators_->plug(cross_mod_total, 7);
 
-    addProcessor(cross_mod_mod_sources);
+    addGlobalProcessor(oscillator1_waveform);
+    addGlobalProcessor(cross_mod);
     addProcessor(cross_mod_total);
     addProcessor(oscillator1_frequency);
     addProcessor(oscillators_);
@@ -175,6 +182,9 @@ namespace mopo {
     oscillators_->plug(oscillator2_waveform, 1);
     oscillators_->plug(oscillator2_frequency, 5);
 
+    addGlobalProcessor(oscillator2_waveform);
+    addGlobalProcessor(oscillator2_transpose);
+    addGlobalProcessor(oscillator2_tune);
     addProcessor(oscillator2_transposed);
     addProcessor(oscillator2_midi);
     addProcessor(oscillator2_frequency);
@@ -189,10 +199,10 @@ namespace mopo {
 
     // Oscillator mix.
     Value* oscillator_mix_amount = new Value(0.5);
-    VariableAdd* mix_mod_sources = new VariableAdd(MOD_MATRIX_SIZE);
+    int mix_mod_sources = mod_matrix_->addDestination();
     Add* mix_total = new Add();
     mix_total->plug(oscillator_mix_amount, 0);
-    mix_total->plug(mix_mod_sources, 1);
+    mix_total->plug(mod_matrix_->output(mix_mod_sources), 1);
 
     Clamp* clamp_mix = new Clamp(0, 1);
     clamp_mix->plug(mix_total);
@@ -201,8 +211,8 @@ namespace mopo {
     oscillator_mix_->plug(oscillators_->output(1), Interpolate::kTo);
     oscillator_mix_->plug(clamp_mix, Interpolate::kFractional);
 
+    addGlobalProcessor(oscillator_mix_amount);
     addProcessor(oscillator_mix_);
-    addProcessor(mix_mod_sources);
     addProcessor(mix_total);
     addProcessor(clamp_mix);
     controls_["osc mix"] =
@@ -217,6 +227,8 @@ namespace mopo {
     lfo1_->plug(lfo1_frequency, Oscillator::kFrequency);
 
     int lfo_wave_resolution = wave_resolution - 1;
+    addGlobalProcessor(lfo1_waveform);
+    addGlobalProcessor(lfo1_frequency);
     addProcessor(lfo1_);
     controls_["lfo 1 waveform"] = new Control(lfo1_waveform,
                                               wave_strings,
@@ -232,6 +244,8 @@ namespace mopo {
     lfo2_->plug(lfo2_waveform, Oscillator::kWaveform);
     lfo2_->plug(lfo2_frequency, Oscillator::kFrequency);
 
+    addGlobalProcessor(lfo2_waveform);
+    addGlobalProcessor(lfo2_frequency);
     addProcessor(lfo2_);
     controls_["lfo 2 waveform"] = new Control(lfo2_waveform,
                                               wave_strings,
@@ -268,6 +282,11 @@ namespace mopo {
     scaled_envelope->plug(filter_envelope_, 0);
     scaled_envelope->plug(filter_envelope_depth, 1);
 
+    addGlobalProcessor(filter_attack);
+    addGlobalProcessor(filter_decay);
+    addGlobalProcessor(filter_sustain);
+    addGlobalProcessor(filter_release);
+    addGlobalProcessor(filter_envelope_depth);
     addProcessor(filter_envelope_);
     addProcessor(scaled_envelope);
 
@@ -294,10 +313,10 @@ namespace mopo {
     midi_cutoff->plug(keytracked_cutoff, 0);
     midi_cutoff->plug(scaled_envelope, 1);
 
-    VariableAdd* cutoff_mod_sources = new VariableAdd(MOD_MATRIX_SIZE);
+    int cutoff_mod_sources = mod_matrix_->addDestination();
     Value* cutoff_mod_scale = new Value(MIDI_SIZE / 2);
     Multiply* cutoff_modulation_scaled = new Multiply();
-    cutoff_modulation_scaled->plug(cutoff_mod_sources, 0);
+    cutoff_modulation_scaled->plug(mod_matrix_->output(cutoff_mod_sources), 0);
     cutoff_modulation_scaled->plug(cutoff_mod_scale, 1);
     Add* midi_cutoff_modulated = new Add();
     midi_cutoff_modulated->plug(midi_cutoff, 0);
@@ -308,10 +327,11 @@ namespace mopo {
 
     Value* resonance = new Value(3);
 
-    VariableAdd* resonance_mod_sources = new VariableAdd(MOD_MATRIX_SIZE);
+    int resonance_mod_sources = mod_matrix_->addDestination();
     Value* resonance_mod_scale = new Value(8);
     Multiply* resonance_modulation_scaled = new Multiply();
-    resonance_modulation_scaled->plug(resonance_mod_sources, 0);
+    resonance_modulation_scaled->plug(
+        mod_matrix_->output(resonance_mod_sources), 0);
     resonance_modulation_scaled->plug(resonance_mod_scale, 1);
     Add* resonance_modulated = new Add();
     resonance_modulated->plug(resonance, 0);
@@ -320,20 +340,24 @@ namespace mopo {
     clamp_resonance->plug(resonance_modulated);
 
     filter_ = new Filter();
+    filter_->setCoefficientInterval(FILTER_COEFFICIENT_INTERVAL);
     filter_->plug(audio, Filter::kAudio);
     filter_->plug(filter_type, Filter::kType);
     filter_->plug(reset, Filter::kReset);
     filter_->plug(frequency_cutoff, Filter::kCutoff);
     filter_->plug(clamp_resonance, Filter::kResonance);
 
+    addGlobalProcessor(filter_type);
+    addGlobalProcessor(keytrack_amount);
     addGlobalProcessor(base_cutoff);
+    addGlobalProcessor(cutoff_mod_scale);
+    addGlobalProcessor(resonance);
+    addGlobalProcessor(resonance_mod_scale);
     addProcessor(current_keytrack);
     addProcessor(keytracked_cutoff);
     addProcessor(midi_cutoff);
-    addProcessor(cutoff_mod_sources);
     addProcessor(cutoff_modulation_scaled);
     addProcessor(midi_cutoff_modulated);
-    addProcessor(resonance_mod_sources);
     addProcessor(resonance_modulation_scaled);
     addProcessor(resonance_modulated);
     addProcessor(clamp_resonance);
@@ -359,22 +383,22 @@ namespace mopo {
     std::vector<std::string> source_names;
     source_names.push_back("");
     output_map::iterator s_iter = mod_sources_.begin();
-    for (; s_iter != mod_sources_.end(); ++s_iter)
+    for (; s_iter != mod_sources_.end(); ++s_iter) {
       source_names.push_back(s_iter->first);
+      int index = mod_matrix_->addSource(s_iter->second);
+      mod_source_indices_[s_iter->first] = index;
+    }
 
     std::vector<std::string> destination_names;
     destination_names.push_back("");
-    input_map::iterator d_iter = mod_destinations_.begin();
+    std::map<std::string, int>::iterator d_iter = mod_destinations_.begin();
     for (; d_iter != mod_destinations_.end(); ++d_iter)
       destination_names.push_back(d_iter->first);
 
     for (int i = 0; i < MOD_MATRIX_SIZE; ++i) {
       mod_matrix_scales_[i] = new Value(0.01);
-      mod_matrix_[i] = new Multiply();
-      mod_matrix_[i]->plug(mod_matrix_scales_[i], 1);
-
+      mod_matrix_->plug(mod_matrix_scales_[i], i);
       addGlobalProcessor(mod_matrix_scales_[i]);
-      addProcessor(mod_matrix_[i]);
 
       MatrixSourceValue* source_value = new MatrixSourceValue(this);
       source_value->setSources(source_names);
@@ -384,6 +408,8 @@ namespace mopo {
           new MatrixDestinationValue(this);
       destination_value->setDestinations(destination_names);
       destination_value->setModulationIndex(i);
+      addGlobalProcessor(source_value);
+      addGlobalProcessor(destination_value);
 
       std::stringstream scale_name;
       scale_name << "mod scale " << i + 1;
@@ -417,6 +443,7 @@ namespace mopo {
         CursynthStrings::legato_strings_ + 2);
     controls_["legato"] =
         new Control(legato, legato_strings, 1);
+    addGlobalProcessor(legato);
     addProcessor(legato_filter);
 
     // Amplitude envelope.
@@ -434,7 +461,10 @@ namespace mopo {
     amplitude_envelope_->plug(amplitude_release, Envelope::kRelease);
 
     addProcessor(amplitude_envelope_);
+    addGlobalProcessor(amplitude_attack);
+    addGlobalProcessor(amplitude_decay);
     addGlobalProcessor(amplitude_sustain);
+    addGlobalProcessor(amplitude_release);
 
     controls_["amp attack"] = new Control(amplitude_attack, 0, 3, MIDI_SIZE);
     controls_["amp decay"] = new Control(amplitude_decay, 0, 3, MIDI_SIZE);
@@ -470,6 +500,7 @@ namespace mopo {
 
     addProcessor(note_from_center_);
     addProcessor(note_percentage);
+    addGlobalProcessor(max_midi_invert);
     addGlobalProcessor(center_adjust);
 
     // Velocity tracking.
@@ -490,6 +521,8 @@ namespace mopo {
     velocity_track_mult->plug(current_velocity, Interpolate::kTo);
     velocity_track_mult->plug(velocity_track_amount, Interpolate::kFractional);
 
+    addGlobalProcessor(velocity_track_amount);
+    addGlobalProcessor(one);
     addProcessor(velocity_track_mult);
     controls_["velocity track"] =
         new Control(velocity_track_amount, 0.0, 1.0, MIDI_SIZE);
@@ -507,6 +540,8 @@ namespace mopo {
     PortamentoFilter* portamento_filter = new PortamentoFilter();
     portamento_filter->plug(portamento_type, PortamentoFilter::kPortamento);
     portamento_filter->plug(frequency_trigger, PortamentoFilter::kTrigger);
+    addGlobalProcessor(portamento);
+    addGlobalProcessor(portamento_type);
     addProcessor(portamento_filter);
 
     current_frequency_ = new LinearSlope();
@@ -537,6 +572,11 @@ namespace mopo {
     mod_sources_["pitch wheel"] = pitch_wheel_amount_->output();
     mod_sources_["mod wheel"] = mod_wheel_amount_->output();
 
+    // The modulation matrix goes in first so everything it modulates is
+    // ordered after it.
+    mod_matrix_ = new ModulationMatrix(MOD_MATRIX_SIZE);
+    addProcessor(mod_matrix_);
+
     // Create all synthesizer voice components.
     createArticulation(note(), velocity(), voice_event());
     createOscillators(current_frequency_->output(),
@@ -554,25 +594,40 @@ namespace mopo {
     addGlobalProcessor(mod_wheel_amount_);
 
     setVoiceOutput(output_);
-    setVoiceKiller(amplitude_envelope_->output(Envelope::kValue));
+    setVoiceKiller(amplitude_envelope_);
+  }
+
+  CursynthVoiceHandler::~CursynthVoiceHandler() {
+    control_map::iterator iter;
+    for (iter = controls_.begin(); iter != controls_.end(); ++iter)
+      delete iter->second;
   }
 
   CursynthEngine::CursynthEngine() {
     // Voice Handler.
     Value* polyphony = new Value(1);
+    Value* voice_steal = new Value(VoiceHandler::kStealOldest);
     voice_handler_ = new CursynthVoiceHandler();
-    voice_handler_->setPolyphony(64);
     voice_handler_->plug(polyphony, VoiceHandler::kPolyphony);
+    voice_handler_->plug(voice_steal, VoiceHandler::kVoiceSteal);
 
+    addProcessor(polyphony);
+    addProcessor(voice_steal);
     addProcessor(voice_handler_);
-    controls_["polyphony"] = new Control(polyphony, 1, 32, 31);
+    controls_["polyphony"] =
+        new Control(polyphony, 1, MAX_POLYPHONY, MAX_POLYPHONY - 1);
+    std::vector<std::string> voice_steal_strings = std::vector<std::string>(
+        CursynthStrings::voice_steal_strings_,
+        CursynthStrings::voice_steal_strings_ + VoiceHandler::kNumVoiceSteals);
+    controls_["voice steal"] = new Control(voice_steal, voice_steal_strings,
+                                           VoiceHandler::kNumVoiceSteals - 1);
 
     // Delay effect.
     SmoothValue* delay_time = new SmoothValue(0.06);
     SmoothValue* delay_feedback = new SmoothValue(-0.3);
     SmoothValue* delay_wet = new SmoothValue(0.3);
 
-    Delay* delay = new Delay();
+    Delay* delay = new Delay(MAX_DELAY_TIME);
     delay->plug(voice_handler_, Delay::kAudio);
     delay->plug(delay_time, Delay::kDelayTime);
     delay->plug(delay_feedback, Delay::kFeedback);
@@ -583,7 +638,8 @@ namespace mopo {
     addProcessor(delay_wet);
     addProcessor(delay);
 
-    controls_["delay time"] = new Control(delay_time, 0.01, 1, MIDI_SIZE);
+    controls_["delay time"] =
+        new Control(delay_time, 0.01, MAX_DELAY_TIME, MIDI_SIZE);
     controls_["delay feedback"] =
         new Control(delay_feedback, -1, 1, MIDI_SIZE);
     controls_["delay dry/wet"] = new Control(delay_wet, 0, 1, MIDI_SIZE);
@@ -604,18 +660,25 @@ namespace mopo {
     controls_["volume"] = new Control(volume, 0, 1, MIDI_SIZE);
   }
 
+  CursynthEngine::~CursynthEngine() {
+    control_map::iterator iter;
+    for (iter = controls_.begin(); iter != controls_.end(); ++iter)
+      delete iter->second;
+  }
+
   control_map CursynthEngine::getControls() {
     control_map voice_controls = voice_handler_->getControls();
     voice_controls.insert(controls_.begin(), controls_.end());
     return voice_controls;
   }
 
-  void CursynthEngine::noteOn(mopo_float note, mopo_float velocity) {
-    voice_handler_->noteOn(note, velocity);
+  void CursynthEngine::noteOn(mopo_float note, mopo_float velocity,
+                              int offset) {
+    voice_handler_->noteOn(note, velocity, offset);
   }
 
-  void CursynthEngine::noteOff(mopo_float note) {
-    voice_handler_->noteOff(note);
+  void CursynthEngine::noteOff(mopo_float note, int offset) {
+    voice_handler_->noteOff(note, offset);
   }
 
   void CursynthVoiceHandler::setModWheel(mopo_float value) {
@@ -627,23 +690,14 @@ namespace mopo {
   }
 
   void CursynthVoiceHandler::setModulationSource(int matrix_index,
-                                                 std::string source) {
-    mod_matrix_[matrix_index]->unplugIndex(0);
-    if (source.length())
-      mod_matrix_[matrix_index]->plug(mod_sources_[source], 0);
+                                                 const std::string& source) {
+    int index = source.length() ? mod_source_indices_[source] : -1;
+    mod_matrix_->setSlotSource(matrix_index, index);
   }
 
   void CursynthVoiceHandler::setModulationDestination(
-      int matrix_index, std::string destination) {
-    std::string current = current_mod_destinations_[matrix_index];
-
-    // First unplug the previous destination.
-    if (current.length())
-      mod_destinations_[current]->unplug(mod_matrix_[matrix_index]);
-
-    // Then plug in to the new destination.
-    current_mod_destinations_[matrix_index] = destination;
-    if (destination.length())
-      mod_destinations_[destination]->plugNext(mod_matrix_[matrix_index]);
+      int matrix_index, const std::string& destination) {
+    int index = destination.length() ? mod_destinations_[destination] : -1;
+    mod_matrix_->setSlotDestination(matrix_index, index);
   }
 } // namespace mopo
@@ -27,7 +27,14 @@
 
 #include <vector>
 
-#define MOD_MATRIX_SIZE 5
+#define MOD_MATRIX_SIZE 32
+// The engine always built 64 voices, so the polyphony control reaches all of
+// them instead of stopping at 32. cursynth_bench plays at polyphony 64.
+#define MAX_POLYPHONY 64
+// The filter coefficients follow the cutoff and resonance every this many
+// samples and ramp in between. Envelopes and LFOs move them every sample, so
+// sharp edges like a square LFO are spread over this many samples.
+#define FILTER_COEFFICIENT_INTERVAL 16
 
 namespace mopo {
   class Add;
@@ -35,6 +42,7 @@ namespace mopo {
   class Filter;
   class Interpolate;
   class LinearSlope;
+  class ModulationMatrix;
   class Multiply;
   class Oscillator;
   class SmoothValue;
@@ -46,15 +54,19 @@ namespace mopo {
       CursynthOscillators();
       CursynthOscillators(const CursynthOscillators& original) :
           TickRouter(original) {
-        oscillator1_ = new Oscillator(*original.oscillator1_);
-        oscillator2_ = new Oscillator(*original.oscillator2_);
-        frequency1_ = new Multiply(*original.frequency1_);
-        frequency2_ = new Multiply(*original.frequency2_);
-        freq_mod1_ = new Multiply(*original.freq_mod1_);
-        freq_mod2_ = new Multiply(*original.freq_mod2_);
-        normalized_fm1_ = new Add(*original.normalized_fm1_);
-        normalized_fm2_ = new Add(*original.normalized_fm2_);
+        // Tick the same copies the router owns so they get sample rate,
+        // buffer size and localization changes.
+        oscillator1_ = copyOf(original, original.oscillator1_);
+        oscillator2_ = copyOf(original, original.oscillator2_);
+        frequency1_ = copyOf(original, original.frequency1_);
+        frequency2_ = copyOf(original, original.frequency2_);
+        freq_mod1_ = copyOf(original, original.freq_mod1_);
+        freq_mod2_ = copyOf(original, original.freq_mod2_);
+        normalized_fm1_ = copyOf(original, original.normalized_fm1_);
+        normalized_fm2_ = copyOf(original, original.normalized_fm2_);
+        one_ = 0;
       }
+      ~CursynthOscillators() { delete one_; }
 
       virtual void process();
       virtual Processor* clone() const { return new CursynthOscillators(*this); }
@@ -73,6 +85,11 @@ namespace mopo {
       }
 
     protected:
+      template<class T>
+      T* copyOf(const CursynthOscillators& original, const T* processor) {
+        return static_cast<T*>(getCopy(original, processor));
+      }
+
       Oscillator* oscillator1_;
       Oscillator* oscillator2_;
       Multiply* frequency1_;
@@ -81,6 +98,9 @@ namespace mopo {
       Multiply* freq_mod2_;
       Add* normalized_fm1_;
       Add* normalized_fm2_;
+
+      // Only the original holds this, copies read the original's output.
+      Value* one_;
   };
 
   // The voice handler duplicates processors to produce polyphony.
@@ -89,14 +109,15 @@ namespace mopo {
   class CursynthVoiceHandler : public VoiceHandler {
     public:
       CursynthVoiceHandler();
+      ~CursynthVoiceHandler();
 
       control_map getControls() { return controls_; }
 
       void setModWheel(mopo_float value);
       void setPitchWheel(mopo_float value);
 
-      void setModulationSource(int index, std::string source);
-      void setModulationDestination(int index, std::string destination);
+      void setModulationSource(int index, const std::string& source);
+      void setModulationDestination(int index, const std::string& destination);
 
     private:
       // Create the portamento, legato, amplifier envelope and other processors
@@ -130,14 +151,14 @@ namespace mopo {
       Multiply* output_;
 
       control_map controls_;
+      ModulationMatrix* mod_matrix_;
       output_map mod_sources_;
-      input_map mod_destinations_;
+      std::map<std::string, int> mod_source_indices_;
+      std::map<std::string, int> mod_destinations_;
 
       std::vector<std::string> mod_source_names_;
       std::vector<std::string> mod_destination_names_;
       Value* mod_matrix_scales_[MOD_MATRIX_SIZE];
-      Multiply* mod_matrix_[MOD_MATRIX_SIZE];
-      std::string current_mod_destinations_[MOD_MATRIX_SIZE];
   };
 
   // A modulation matrix source entry.
@@ -200,9 +221,11 @@ namespace mopo {
   class CursynthEngine : public ProcessorRouter {
     public:
       CursynthEngine();
+      ~CursynthEngine();
 
       control_map getControls();
 
+      // The mod wheel goes from 0 to 1 and the pitch wheel from -1 to 1.
       void setModWheel(mopo_float value) {
         voice_handler_->setModWheel(value);
       }
@@ -210,13 +233,42 @@ namespace mopo {
         voice_handler_->setPitchWheel(value);
       }
 
-      // Keyboard events.
-      void noteOn(mopo_float note, mopo_float velocity = 1.0);
-      void noteOff(mopo_float note);
+      // Keyboard events. _offset_ is the sample in the next buffer the event
+      // happens at.
+      void noteOn(mopo_float note, mopo_float velocity = 1.0, int offset = 0);
+      void noteOff(mopo_float note, int offset = 0);
 
       // Sustain pedal events.
       void sustainOn() { voice_handler_->sustainOn(); }
-      void sustainOff() { voice_handler_->sustainOff(); }
+      void sustainOff(int offset = 0) { voice_handler_->sustainOff(offset); }
+
+      // Process all voices in lockstep instead of one after another.
+      void setVoiceBank(bool voice_bank) {
+        voice_handler_->setVoiceBank(voice_bank);
+      }
+
+      // Render voices on _num_threads_ threads.
+      void setVoiceThreads(int num_threads) {
+        voice_handler_->setVoiceThreads(num_threads);
+      }
+
+      // Creates the voices for the full polyphony range, here or on a
+      // background thread. Call one of these once the sample rate, buffer
+      // size and voice modes are set. The polyphony control only turns these
+      // voices on and off.
+      // Notes that arrive before the first block can use every voice, the
+      // polyphony control takes over once we process.
+      void createVoices() {
+        voice_handler_->createVoices(MAX_POLYPHONY);
+        voice_handler_->setPolyphony(MAX_POLYPHONY);
+      }
+      void createVoicesInBackground() {
+        voice_handler_->createVoicesInBackground(MAX_POLYPHONY);
+      }
+
+      // While this is true nothing may change the voice graph, so hold off
+      // on control changes.
+      bool creatingVoices() const { return voice_handler_->creatingVoices(); }
 
     private:
       CursynthVoiceHandler* voice_handler_;
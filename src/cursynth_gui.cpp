@@ -18,6 +18,7 @@
 
 #include "value.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <libintl.h>
@@ -40,6 +41,121 @@
 #define SAVE_COLUMN 2
 #define PATCH_BROWSER_ROWS 5
 #define PATCH_BROWSER_WIDTH 26
+#define MOD_MATRIX_Y 36
+#define MOD_MATRIX_ROWS 5
+
+namespace {
+
+  // Every slot name is spelled out so xgettext can extract them. Keep these
+  // in step with MOD_MATRIX_SIZE in cursynth_engine.h.
+  const char* mod_source_names[] = {
+    gettext_noop("mod source 1"),
+    gettext_noop("mod source 2"),
+    gettext_noop("mod source 3"),
+    gettext_noop("mod source 4"),
+    gettext_noop("mod source 5"),
+    gettext_noop("mod source 6"),
+    gettext_noop("mod source 7"),
+    gettext_noop("mod source 8"),
+    gettext_noop("mod source 9"),
+    gettext_noop("mod source 10"),
+    gettext_noop("mod source 11"),
+    gettext_noop("mod source 12"),
+    gettext_noop("mod source 13"),
+    gettext_noop("mod source 14"),
+    gettext_noop("mod source 15"),
+    gettext_noop("mod source 16"),
+    gettext_noop("mod source 17"),
+    gettext_noop("mod source 18"),
+    gettext_noop("mod source 19"),
+    gettext_noop("mod source 20"),
+    gettext_noop("mod source 21"),
+    gettext_noop("mod source 22"),
+    gettext_noop("mod source 23"),
+    gettext_noop("mod source 24"),
+    gettext_noop("mod source 25"),
+    gettext_noop("mod source 26"),
+    gettext_noop("mod source 27"),
+    gettext_noop("mod source 28"),
+    gettext_noop("mod source 29"),
+    gettext_noop("mod source 30"),
+    gettext_noop("mod source 31"),
+    gettext_noop("mod source 32"),
+  };
+
+  const char* mod_scale_names[] = {
+    gettext_noop("mod scale 1"),
+    gettext_noop("mod scale 2"),
+    gettext_noop("mod scale 3"),
+    gettext_noop("mod scale 4"),
+    gettext_noop("mod scale 5"),
+    gettext_noop("mod scale 6"),
+    gettext_noop("mod scale 7"),
+    gettext_noop("mod scale 8"),
+    gettext_noop("mod scale 9"),
+    gettext_noop("mod scale 10"),
+    gettext_noop("mod scale 11"),
+    gettext_noop("mod scale 12"),
+    gettext_noop("mod scale 13"),
+    gettext_noop("mod scale 14"),
+    gettext_noop("mod scale 15"),
+    gettext_noop("mod scale 16"),
+    gettext_noop("mod scale 17"),
+    gettext_noop("mod scale 18"),
+    gettext_noop("mod scale 19"),
+    gettext_noop("mod scale 20"),
+    gettext_noop("mod scale 21"),
+    gettext_noop("mod scale 22"),
+    gettext_noop("mod scale 23"),
+    gettext_noop("mod scale 24"),
+    gettext_noop("mod scale 25"),
+    gettext_noop("mod scale 26"),
+    gettext_noop("mod scale 27"),
+    gettext_noop("mod scale 28"),
+    gettext_noop("mod scale 29"),
+    gettext_noop("mod scale 30"),
+    gettext_noop("mod scale 31"),
+    gettext_noop("mod scale 32"),
+  };
+
+  const char* mod_destination_names[] = {
+    gettext_noop("mod destination 1"),
+    gettext_noop("mod destination 2"),
+    gettext_noop("mod destination 3"),
+    gettext_noop("mod destination 4"),
+    gettext_noop("mod destination 5"),
+    gettext_noop("mod destination 6"),
+    gettext_noop("mod destination 7"),
+    gettext_noop("mod destination 8"),
+    gettext_noop("mod destination 9"),
+    gettext_noop("mod destination 10"),
+    gettext_noop("mod destination 11"),
+    gettext_noop("mod destination 12"),
+    gettext_noop("mod destination 13"),
+    gettext_noop("mod destination 14"),
+    gettext_noop("mod destination 15"),
+    gettext_noop("mod destination 16"),
+    gettext_noop("mod destination 17"),
+    gettext_noop("mod destination 18"),
+    gettext_noop("mod destination 19"),
+    gettext_noop("mod destination 20"),
+    gettext_noop("mod destination 21"),
+    gettext_noop("mod destination 22"),
+    gettext_noop("mod destination 23"),
+    gettext_noop("mod destination 24"),
+    gettext_noop("mod destination 25"),
+    gettext_noop("mod destination 26"),
+    gettext_noop("mod destination 27"),
+    gettext_noop("mod destination 28"),
+    gettext_noop("mod destination 29"),
+    gettext_noop("mod destination 30"),
+    gettext_noop("mod destination 31"),
+    gettext_noop("mod destination 32"),
+  };
+
+  const int num_mod_slot_names =
+      sizeof(mod_source_names) / sizeof(mod_source_names[0]);
+} // namespace
 
 namespace mopo {
 
@@ -150,6 +266,15 @@ namespace mopo {
     printw("                     ");
     move(35, 79);
     printw(gettext("destination"));
+
+    // Clear the rows of the last page and number the slots of this one.
+    for (int row = 0; row < MOD_MATRIX_ROWS; ++row) {
+      int slot = modulation_page_ * MOD_MATRIX_ROWS + row;
+      move(MOD_MATRIX_Y + row, 21);
+      hline(' ', 77);
+      if (slot < num_modulation_slots_)
+        printw("%3d", slot + 1);
+    }
   }
 
   void CursynthGui::drawMidi(std::string status) {
@@ -306,6 +431,13 @@ namespace mopo {
     if (!details)
       return;
 
+    // Controls on other modulation matrix pages are hidden until selected.
+    if (details->page != ALWAYS_SHOWN && details->page != modulation_page_) {
+      if (!active)
+        return;
+      showModulationPage(details->page);
+    }
+
     // Draw label.
     if (details->label.size()) {
       if (active)
@@ -403,18 +535,44 @@ namespace mopo {
 
   void CursynthGui::placeMinimalControl(std::string name,
                                         const Control* control,
-                                        int x, int y, int width) {
+                                        int x, int y, int width, int page) {
     DisplayDetails* details = initControl(name, control);
     details->x = x;
     details->y = y;
     details->width = width;
     details->label = "";
     details->bipolar = control->isBipolar();
+    details->page = page;
 
     details_lookup_[control] = details;
     drawControl(control, false);
   }
 
+  void CursynthGui::placeModulationSlot(int slot, const Control* source,
+                                        const Control* scale,
+                                        const Control* destination) {
+    int y = MOD_MATRIX_Y + slot % MOD_MATRIX_ROWS;
+    int page = slot / MOD_MATRIX_ROWS;
+    num_modulation_slots_ = std::max(num_modulation_slots_, slot + 1);
+
+    placeMinimalControl(mod_source_names[slot], source, 26, y, 22, page);
+    placeMinimalControl(mod_scale_names[slot], scale, 50, y, 22, page);
+    placeMinimalControl(mod_destination_names[slot], destination,
+                        74, y, 22, page);
+  }
+
+  void CursynthGui::showModulationPage(int page) {
+    modulation_page_ = page;
+    drawModulationMatrix();
+
+    std::map<const Control*, DisplayDetails*>::iterator iter =
+        details_lookup_.begin();
+    for (; iter != details_lookup_.end(); ++iter) {
+      if (iter->second->page == page)
+        drawControl(iter->first, false);
+    }
+  }
+
   void CursynthGui::placeControl(std::string name, const Control* control,
                                  int x, int y, int width) {
     DisplayDetails* details = initControl(name, control);
@@ -423,6 +581,7 @@ namespace mopo {
     details->width = width;
     details->label = name;
     details->bipolar = control->isBipolar();
+    details->page = ALWAYS_SHOWN;
 
     details_lookup_[control] = details;
     drawControl(control, false);
@@ -522,6 +681,9 @@ namespace mopo {
     placeControl(gettext_noop("pitch bend range"),
                  controls.at("pitch bend range"),
                  82, 13, 38);
+    placeControl(gettext_noop("voice steal"),
+                 controls.at("voice steal"),
+                 82, 16, 38);
 
     // Amplitude Envelope.
     placeControl(gettext_noop("amp attack"),
@@ -541,51 +703,15 @@ namespace mopo {
                  82, 31, 38);
 
     // Modulation Matrix.
-    placeMinimalControl(gettext_noop("mod source 1"),
-                        controls.at("mod source 1"),
-                        26, 36, 22);
-    placeMinimalControl(gettext_noop("mod scale 1"),
-                        controls.at("mod scale 1"),
-                        50, 36, 22);
-    placeMinimalControl(gettext_noop("mod destination 1"),
-                        controls.at("mod destination 1"),
-                        74, 36, 22);
-    placeMinimalControl(gettext_noop("mod source 2"),
-                        controls.at("mod source 2"),
-                        26, 37, 22);
-    placeMinimalControl(gettext_noop("mod scale 2"),
-                        controls.at("mod scale 2"),
-                        50, 37, 22);
-    placeMinimalControl(gettext_noop("mod destination 2"),
-                        controls.at("mod destination 2"),
-                        74, 37, 22);
-    placeMinimalControl(gettext_noop("mod source 3"),
-                        controls.at("mod source 3"),
-                        26, 38, 22);
-    placeMinimalControl(gettext_noop("mod scale 3"),
-                        controls.at("mod scale 3"),
-                        50, 38, 22);
-    placeMinimalControl(gettext_noop("mod destination 3"),
-                        controls.at("mod destination 3"),
-                        74, 38, 22);
-    placeMinimalControl(gettext_noop("mod source 4"),
-                        controls.at("mod source 4"),
-                        26, 39, 22);
-    placeMinimalControl(gettext_noop("mod scale 4"),
-                        controls.at("mod scale 4"),
-                        50, 39, 22);
-    placeMinimalControl(gettext_noop("mod destination 4"),
-                        controls.at("mod destination 4"),
-                        74, 39, 22);
-    placeMinimalControl(gettext_noop("mod source 5"),
-                        controls.at("mod source 5"),
-                        26, 40, 22);
-    placeMinimalControl(gettext_noop("mod scale 5"),
-                        controls.at("mod scale 5"),
-                        50, 40, 22);
-    placeMinimalControl(gettext_noop("mod destination 5"),
-                        controls.at("mod destination 5"),
-                        74, 40, 22);
+    for (int slot = 0; slot < num_mod_slot_names; ++slot) {
+      if (controls.count(mod_source_names[slot]) == 0)
+        break;
+
+      placeModulationSlot(slot, controls.at(mod_source_names[slot]),
+                          controls.at(mod_scale_names[slot]),
+                          controls.at(mod_destination_names[slot]));
+    }
+    showModulationPage(modulation_page_);
   }
 
   std::string CursynthGui::getCurrentControl() {
@@ -28,11 +28,13 @@
 namespace mopo {
   class Value;
 
-  // Stores information on how and where to draw a control.
+  // Stores information on how and where to draw a control. Modulation matrix
+  // slots are shown a page at a time, other controls are always shown.
   struct DisplayDetails {
     int x, y, width;
     std::string label;
     bool bipolar;
+    int page;
   };
 
   class CursynthGui {
@@ -47,7 +49,12 @@ namespace mopo {
         CONTROL_TEXT_COLOR
       };
 
-      CursynthGui() : control_index_(0) { }
+      enum {
+        ALWAYS_SHOWN = -1
+      };
+
+      CursynthGui() :
+          control_index_(0), modulation_page_(0), num_modulation_slots_(0) { }
 
       // Start and stop the GUI.
       void start();
@@ -88,13 +95,24 @@ namespace mopo {
       void placeControl(std::string name, const Control* control,
                         int x, int y, int width);
 
-      // Place a given control (slider only) at a location and width.
+      // Place a given control (slider only) at a location and width, shown
+      // with modulation matrix page _page_.
       void placeMinimalControl(std::string name, const Control* control,
-                               int x, int y, int width);
+                               int x, int y, int width, int page);
+
+      // Place the controls of a modulation matrix slot on its page's row.
+      void placeModulationSlot(int slot, const Control* source,
+                               const Control* scale,
+                               const Control* destination);
+
+      // Switches the modulation matrix rows over to page _page_.
+      void showModulationPage(int page);
 
       std::map<const Control*, DisplayDetails*> details_lookup_;
       std::vector<std::string> control_order_;
       int control_index_;
+      int modulation_page_;
+      int num_modulation_slots_;
   };
 } // namespace mopo
 
@@ -0,0 +1,45 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * cursynth is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cursynth is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cursynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cursynth_patch.h"
+
+#include "cJSON.h"
+
+#define MOD_SLOT_PREFIX "mod "
+
+namespace mopo {
+
+  bool readPatchState(const control_map& controls, const std::string& state) {
+    cJSON* root = cJSON_Parse(state.c_str());
+    if (root == 0)
+      return false;
+
+    control_map::const_iterator iter = controls.begin();
+    for (; iter != controls.end(); ++iter) {
+      cJSON* value = cJSON_GetObjectItem(root, iter->first.c_str());
+      if (value)
+        iter->second->set(value->valuedouble);
+      else if (iter->first.find(MOD_SLOT_PREFIX) == 0) {
+        // Older patches have fewer mod slots. Clear the rest so routes from
+        // the last patch don't linger.
+        iter->second->reset();
+      }
+    }
+
+    cJSON_Delete(root);
+    return true;
+  }
+} // namespace mopo
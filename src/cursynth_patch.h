@@ -0,0 +1,33 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * cursynth is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cursynth is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cursynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef CURSYNTH_PATCH_H
+#define CURSYNTH_PATCH_H
+
+#include "cursynth_common.h"
+
+#include <string>
+
+namespace mopo {
+
+  // Sets every control in _controls_ that the JSON patch _state_ has a value
+  // for and resets mod matrix slots it doesn't have. Returns false if _state_
+  // isn't JSON.
+  bool readPatchState(const control_map& controls, const std::string& state);
+} // namespace mopo
+
+#endif // CURSYNTH_PATCH_H
@@ -0,0 +1,537 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * cursynth is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cursynth is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cursynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cursynth_render.h"
+
+#include "cursynth_patch.h"
+#include "denormals.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/time.h>
+
+// Seconds rendered after the last event so released notes can ring out.
+#define RENDER_TAIL 2.0
+#define WAV_HEADER_SIZE 44
+#define WAV_BITS_PER_SAMPLE 16
+#define MIDI_DEFAULT_TEMPO 500000
+#define MIDI_MOD_WHEEL_ID 1
+#define MIDI_SUSTAIN_ID 64
+#define MIDI_PITCH_BEND_CENTER 8192
+
+namespace {
+
+  struct MidiEvent {
+    unsigned tick;
+    mopo::RenderEvent::Type type;
+    mopo::mopo_float note;
+    mopo::mopo_float value;
+  };
+
+  struct TempoChange {
+    unsigned tick;
+    unsigned microseconds_per_quarter;
+  };
+
+  bool compareMidiEvents(const MidiEvent& left, const MidiEvent& right) {
+    return left.tick < right.tick;
+  }
+
+  bool compareTempoChanges(const TempoChange& left, const TempoChange& right) {
+    return left.tick < right.tick;
+  }
+
+  bool compareRenderEvents(const mopo::RenderEvent& left,
+                           const mopo::RenderEvent& right) {
+    return left.time < right.time;
+  }
+
+  bool readFile(const std::string& file_name, std::string* contents) {
+    std::ifstream file(file_name.c_str(), std::ios::binary);
+    if (!file.is_open())
+      return false;
+
+    std::stringstream stream;
+    stream << file.rdbuf();
+    *contents = stream.str();
+    return true;
+  }
+
+  double currentSeconds() {
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return now.tv_sec + now.tv_usec / 1000000.0;
+  }
+
+  // Reads big endian numbers out of a MIDI file, failing past _end_.
+  class MidiReader {
+    public:
+      MidiReader(const std::string& data, size_t position, size_t end) :
+          data_(data), position_(position), end_(end) { }
+
+      bool done() const { return position_ >= end_; }
+      size_t position() const { return position_; }
+
+      bool read(int num_bytes, unsigned* value) {
+        if (position_ + num_bytes > end_)
+          return false;
+
+        *value = 0;
+        for (int i = 0; i < num_bytes; ++i)
+          *value = (*value << 8) | static_cast<unsigned char>(data_[position_++]);
+        return true;
+      }
+
+      bool readVariable(unsigned* value) {
+        *value = 0;
+        for (int i = 0; i < 4; ++i) {
+          unsigned byte = 0;
+          if (!read(1, &byte))
+            return false;
+
+          *value = (*value << 7) | (byte & 0x7f);
+          if ((byte & 0x80) == 0)
+            return true;
+        }
+        return false;
+      }
+
+      bool skip(unsigned num_bytes) {
+        if (position_ + num_bytes > end_)
+          return false;
+        position_ += num_bytes;
+        return true;
+      }
+
+    private:
+      const std::string& data_;
+      size_t position_;
+      size_t end_;
+  };
+
+  void writeLittleEndian(FILE* file, unsigned value, int num_bytes) {
+    for (int i = 0; i < num_bytes; ++i)
+      fputc((value >> (8 * i)) & 0xff, file);
+  }
+
+  // Writes a mono 16 bit PCM header for _num_samples_ samples.
+  void writeWavHeader(FILE* file, unsigned sample_rate, unsigned num_samples) {
+    unsigned block_align = WAV_BITS_PER_SAMPLE / 8;
+    unsigned data_size = num_samples * block_align;
+
+    fputs("RIFF", file);
+    writeLittleEndian(file, WAV_HEADER_SIZE - 8 + data_size, 4);
+    fputs("WAVE", file);
+    fputs("fmt ", file);
+    writeLittleEndian(file, 16, 4);
+    writeLittleEndian(file, 1, 2);
+    writeLittleEndian(file, 1, 2);
+    writeLittleEndian(file, sample_rate, 4);
+    writeLittleEndian(file, sample_rate * block_align, 4);
+    writeLittleEndian(file, block_align, 2);
+    writeLittleEndian(file, WAV_BITS_PER_SAMPLE, 2);
+    fputs("data", file);
+    writeLittleEndian(file, data_size, 4);
+  }
+} // namespace
+
+namespace mopo {
+
+  CursynthRender::CursynthRender(unsigned sample_rate, unsigned buffer_size) :
+      sample_rate_(sample_rate), end_time_(-1.0) {
+    buffer_size_ = CLAMP(static_cast<int>(buffer_size), 1, MAX_BUFFER_SIZE);
+    synth_.setSampleRate(sample_rate_);
+    synth_.setBufferSize(buffer_size_);
+    synth_.createVoices();
+    controls_ = synth_.getControls();
+  }
+
+  bool CursynthRender::loadPatch(const std::string& file_name) {
+    std::string contents;
+    if (!readFile(file_name, &contents) &&
+        !readFile(std::string(PATCHES_DIRECTORY) + "/" + file_name,
+                  &contents)) {
+      std::cerr << "Could not open patch " << file_name << std::endl;
+      return false;
+    }
+
+    if (!readPatchState(controls_, contents)) {
+      std::cerr << "Could not parse patch " << file_name << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool CursynthRender::loadEvents(const std::string& file_name) {
+    std::string contents;
+    if (!readFile(file_name, &contents)) {
+      std::cerr << "Could not open events " << file_name << std::endl;
+      return false;
+    }
+
+    bool success = false;
+    if (contents.compare(0, 4, "MThd") == 0)
+      success = readMidiFile(contents);
+    else
+      success = readEventFile(contents);
+
+    if (!success) {
+      std::cerr << "Could not read events " << file_name << std::endl;
+      return false;
+    }
+
+    std::stable_sort(events_.begin(), events_.end(), compareRenderEvents);
+    return true;
+  }
+
+  bool CursynthRender::readEventFile(const std::string& contents) {
+    std::istringstream lines(contents);
+    std::string line;
+    for (int line_number = 1; std::getline(lines, line); ++line_number) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream words(line);
+
+      double time = 0.0;
+      std::string type;
+      if (!(words >> time)) {
+        // Blank and comment lines are fine, anything else is not.
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+          continue;
+        std::cerr << "line " << line_number << ": expected a time" << std::endl;
+        return false;
+      }
+
+      bool success = true;
+      mopo_float note = 0.0;
+      mopo_float value = 0.0;
+      std::string control;
+      if (!(words >> type) || time < 0.0)
+        success = false;
+      else if (type == "note_on") {
+        success = !(words >> note >> value).fail();
+        addEvent(time, RenderEvent::kNoteOn, note, value);
+      }
+      else if (type == "note_off") {
+        success = !(words >> note).fail();
+        addEvent(time, RenderEvent::kNoteOff, note);
+      }
+      else if (type == "sustain_on")
+        addEvent(time, RenderEvent::kSustainOn);
+      else if (type == "sustain_off")
+        addEvent(time, RenderEvent::kSustainOff);
+      else if (type == "mod_wheel") {
+        success = !(words >> value).fail();
+        addEvent(time, RenderEvent::kModWheel, 0.0, value);
+      }
+      else if (type == "pitch_wheel") {
+        success = !(words >> value).fail();
+        addEvent(time, RenderEvent::kPitchWheel, 0.0, value);
+      }
+      else if (type == "control") {
+        // Control names can have spaces so the value is the last word.
+        std::string rest;
+        std::getline(words, rest);
+        size_t start = rest.find_first_not_of(" \t\r");
+        size_t end = rest.find_last_not_of(" \t\r");
+        size_t split = rest.find_last_of(" \t", end);
+        success = false;
+        if (start != std::string::npos && split != std::string::npos &&
+            split > start) {
+          size_t name_end = rest.find_last_not_of(" \t", split);
+          control = rest.substr(start, name_end - start + 1);
+          std::istringstream value_word(rest.substr(split + 1));
+          success = !(value_word >> value).fail() &&
+                    controls_.find(control) != controls_.end();
+        }
+        addEvent(time, RenderEvent::kControl, 0.0, value, control);
+      }
+      else if (type == "end")
+        end_time_ = time;
+      else
+        success = false;
+
+      if (!success) {
+        std::cerr << "line " << line_number << ": bad event" << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool CursynthRender::readMidiFile(const std::string& contents) {
+    MidiReader header(contents, 0, contents.size());
+    unsigned header_size = 0, format = 0, num_tracks = 0, division = 0;
+    if (!header.skip(4) || !header.read(4, &header_size) ||
+        header_size < 6 || !header.read(2, &format) ||
+        !header.read(2, &num_tracks) || !header.read(2, &division) ||
+        !header.skip(header_size - 6) || format > 1) {
+      return false;
+    }
+
+    std::vector<MidiEvent> midi_events;
+    std::vector<TempoChange> tempo_changes;
+    unsigned last_tick = 0;
+    size_t chunk_start = header.position();
+
+    unsigned tracks_read = 0;
+    while (tracks_read < num_tracks) {
+      MidiReader chunk(contents, chunk_start, contents.size());
+      unsigned chunk_size = 0;
+      if (!chunk.skip(4) || !chunk.read(4, &chunk_size))
+        return false;
+
+      size_t track_start = chunk.position();
+      chunk_start = track_start + chunk_size;
+      if (chunk_start > contents.size())
+        return false;
+
+      // Skip chunks that aren't tracks.
+      if (contents.compare(track_start - 8, 4, "MTrk"))
+        continue;
+      tracks_read++;
+
+      MidiReader reader(contents, track_start, chunk_start);
+      unsigned tick = 0;
+      unsigned status = 0;
+      while (!reader.done()) {
+        unsigned delta = 0, byte = 0;
+        if (!reader.readVariable(&delta) || !reader.read(1, &byte))
+          return false;
+        tick += delta;
+
+        if (byte == 0xff) {
+          unsigned meta_type = 0, length = 0, tempo = 0;
+          if (!reader.read(1, &meta_type) || !reader.readVariable(&length))
+            return false;
+
+          if (meta_type == 0x51 && length == 3) {
+            if (!reader.read(3, &tempo))
+              return false;
+            TempoChange change = { tick, tempo };
+            tempo_changes.push_back(change);
+          }
+          else if (!reader.skip(length))
+            return false;
+          continue;
+        }
+        if (byte == 0xf0 || byte == 0xf7) {
+          unsigned length = 0;
+          if (!reader.readVariable(&length) || !reader.skip(length))
+            return false;
+          continue;
+        }
+
+        // Data bytes reuse the last status byte.
+        unsigned data1 = 0, data2 = 0;
+        if (byte & 0x80)
+          status = byte;
+        else if (status)
+          data1 = byte;
+        else
+          return false;
+
+        unsigned command = status & 0xf0;
+        bool one_data_byte = command == 0xc0 || command == 0xd0;
+        if ((byte & 0x80) && !reader.read(1, &data1))
+          return false;
+        if (!one_data_byte && !reader.read(1, &data2))
+          return false;
+
+        MidiEvent event = { tick, RenderEvent::kNoteOn, 0.0, 0.0 };
+        if (command == 0x90 && data2) {
+          event.note = data1;
+          event.value = (1.0 * data2) / MIDI_SIZE;
+        }
+        else if (command == 0x80 || command == 0x90) {
+          event.type = RenderEvent::kNoteOff;
+          event.note = data1;
+        }
+        else if (command == 0xb0 && data1 == MIDI_SUSTAIN_ID)
+          event.type = data2 ? RenderEvent::kSustainOn : RenderEvent::kSustainOff;
+        else if (command == 0xb0 && data1 == MIDI_MOD_WHEEL_ID) {
+          event.type = RenderEvent::kModWheel;
+          event.value = data2 / (MIDI_SIZE - 1.0);
+        }
+        else if (command == 0xe0) {
+          int bend = ((data2 << 7) | data1) - MIDI_PITCH_BEND_CENTER;
+          event.type = RenderEvent::kPitchWheel;
+          event.value = (1.0 * bend) / MIDI_PITCH_BEND_CENTER;
+        }
+        else
+          continue;
+
+        midi_events.push_back(event);
+      }
+      last_tick = std::max(last_tick, tick);
+    }
+
+    // Convert ticks to seconds. Negative divisions are SMPTE frames per second
+    // and ticks per frame and don't use tempo.
+    std::stable_sort(midi_events.begin(), midi_events.end(), compareMidiEvents);
+    std::stable_sort(tempo_changes.begin(), tempo_changes.end(),
+                     compareTempoChanges);
+
+    double seconds_per_tick = 0.0;
+    bool smpte = division & 0x8000;
+    if (smpte) {
+      int frames_per_second = 256 - (division >> 8);
+      seconds_per_tick = 1.0 / (frames_per_second * (division & 0xff));
+    }
+    else if (division == 0)
+      return false;
+    else
+      seconds_per_tick = MIDI_DEFAULT_TEMPO / (1000000.0 * division);
+
+    size_t tempo_index = 0;
+    unsigned tempo_tick = 0;
+    double tempo_time = 0.0;
+    MidiEvent end = { last_tick, RenderEvent::kNoteOff, 0.0, 0.0 };
+    midi_events.push_back(end);
+
+    for (size_t i = 0; i < midi_events.size(); ++i) {
+      const MidiEvent& event = midi_events[i];
+      while (!smpte && tempo_index < tempo_changes.size() &&
+             tempo_changes[tempo_index].tick <= event.tick) {
+        const TempoChange& change = tempo_changes[tempo_index++];
+        tempo_time += (change.tick - tempo_tick) * seconds_per_tick;
+        tempo_tick = change.tick;
+        seconds_per_tick = change.microseconds_per_quarter /
+                           (1000000.0 * division);
+      }
+
+      double time = tempo_time + (event.tick - tempo_tick) * seconds_per_tick;
+      if (i == midi_events.size() - 1)
+        end_time_ = time + RENDER_TAIL;
+      else
+        addEvent(time, event.type, event.note, event.value);
+    }
+    return true;
+  }
+
+  void CursynthRender::addEvent(double time, RenderEvent::Type type,
+                                mopo_float note, mopo_float value,
+                                const std::string& control) {
+    RenderEvent event;
+    event.time = time;
+    event.type = type;
+    event.note = note;
+    event.value = value;
+    event.control = control;
+    events_.push_back(event);
+  }
+
+  void CursynthRender::processEvent(const RenderEvent& event, int offset) {
+    switch (event.type) {
+      case RenderEvent::kNoteOn:
+        synth_.noteOn(event.note, event.value, offset);
+        break;
+      case RenderEvent::kNoteOff:
+        synth_.noteOff(event.note, offset);
+        break;
+      case RenderEvent::kSustainOn:
+        synth_.sustainOn();
+        break;
+      case RenderEvent::kSustainOff:
+        synth_.sustainOff(offset);
+        break;
+      case RenderEvent::kModWheel:
+        synth_.setModWheel(event.value);
+        break;
+      case RenderEvent::kPitchWheel:
+        synth_.setPitchWheel(event.value);
+        break;
+      case RenderEvent::kControl:
+        controls_.at(event.control)->set(event.value);
+        break;
+    }
+  }
+
+  bool CursynthRender::render(const std::string& file_name) {
+    FILE* file = fopen(file_name.c_str(), "wb");
+    if (file == 0) {
+      std::cerr << "Could not open " << file_name << std::endl;
+      return false;
+    }
+
+    double end_time = end_time_;
+    if (end_time < 0.0)
+      end_time = (events_.size() ? events_.back().time : 0.0) + RENDER_TAIL;
+    unsigned num_samples = ceil(end_time * sample_rate_);
+
+    // The header sizes are rewritten once we're done in case we stop early.
+    writeWavHeader(file, sample_rate_, num_samples);
+    std::vector<unsigned char> pcm(buffer_size_ * WAV_BITS_PER_SAMPLE / 8);
+
+    // Render in the same floating point mode the audio callback uses.
+    ScopedFlushDenormals flush_denormals;
+
+    double start = currentSeconds();
+    size_t event_index = 0;
+    unsigned rendered = 0;
+    while (rendered < num_samples) {
+      // Notes and the sustain pedal land on their exact sample in the
+      // buffer. Everything else lands at the start of the buffer.
+      unsigned buffer_end = rendered + buffer_size_;
+      while (event_index < events_.size() &&
+             events_[event_index].time * sample_rate_ < buffer_end) {
+        const RenderEvent& event = events_[event_index++];
+        int offset = event.time * sample_rate_ - rendered;
+        processEvent(event, std::max(offset, 0));
+      }
+
+      synth_.process();
+
+      const mopo_float* buffer = synth_.output()->buffer;
+      unsigned num_frames = std::min(buffer_size_, num_samples - rendered);
+      for (unsigned i = 0; i < num_frames; ++i) {
+        // WAV data is little endian.
+        mopo_float sample = CLAMP(buffer[i], -1.0, 1.0);
+        unsigned short bits = static_cast<short>(lrint(sample * 32767.0));
+        pcm[2 * i] = bits & 0xff;
+        pcm[2 * i + 1] = bits >> 8;
+      }
+
+      if (fwrite(&pcm[0], 2, num_frames, file) != num_frames)
+        break;
+      rendered += num_frames;
+    }
+    double elapsed = currentSeconds() - start;
+
+    fseek(file, 0, SEEK_SET);
+    writeWavHeader(file, sample_rate_, rendered);
+    bool success = !ferror(file);
+    success = fclose(file) == 0 && success;
+    if (!success) {
+      std::cerr << "Could not write " << file_name << std::endl;
+      return false;
+    }
+
+    double rendered_seconds = (1.0 * rendered) / sample_rate_;
+    std::cout << "Rendered " << rendered_seconds << " seconds ("
+              << rendered << " samples) in " << elapsed << " seconds"
+              << std::endl;
+    if (elapsed > 0.0) {
+      std::cout << "Realtime factor: " << rendered_seconds / elapsed << "x"
+                << std::endl;
+      std::cout << "Samples per second: " << rendered / elapsed << std::endl;
+    }
+    return true;
+  }
+} // namespace mopo
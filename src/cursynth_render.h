@@ -0,0 +1,99 @@
+/* Copyright 2013-2015 Matt Tytel
+ *
+ * cursynth is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cursynth is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cursynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef CURSYNTH_RENDER_H
+#define CURSYNTH_RENDER_H
+
+#include "cursynth_engine.h"
+
+#include <string>
+#include <vector>
+
+namespace mopo {
+
+  // Something to do to the synth at a given time in an offline render.
+  struct RenderEvent {
+    enum Type {
+      kNoteOn,
+      kNoteOff,
+      kSustainOn,
+      kSustainOff,
+      kModWheel,
+      kPitchWheel,
+      kControl,
+    };
+
+    double time;
+    Type type;
+    mopo_float note;
+    mopo_float value;
+    std::string control;
+  };
+
+  // Renders the synth to a WAV file as fast as possible without an audio
+  // device, MIDI devices or the terminal interface. Events come from a text
+  // event file or a Standard MIDI File.
+  class CursynthRender {
+    public:
+      CursynthRender(unsigned sample_rate, unsigned buffer_size);
+
+      void setVoiceBank(bool voice_bank) { synth_.setVoiceBank(voice_bank); }
+      void setVoiceThreads(int num_threads) {
+        synth_.setVoiceThreads(num_threads);
+      }
+
+      // Loads the patch _file_name_, looking in the system patches directory
+      // if it isn't found as given.
+      bool loadPatch(const std::string& file_name);
+
+      // Loads events from a Standard MIDI File or a text event file.
+      bool loadEvents(const std::string& file_name);
+
+      // Renders the events and writes the output to the WAV file _file_name_.
+      // Prints the realtime factor and samples per second when done.
+      bool render(const std::string& file_name);
+
+    private:
+      // Text event files have one event per line:
+      //   <seconds> note_on <note> <velocity 0-1>
+      //   <seconds> note_off <note>
+      //   <seconds> sustain_on | sustain_off
+      //   <seconds> mod_wheel <0-1>
+      //   <seconds> pitch_wheel <-1-1>
+      //   <seconds> control <control name> <value>
+      //   <seconds> end
+      // Anything after a '#' is ignored.
+      bool readEventFile(const std::string& contents);
+      bool readMidiFile(const std::string& contents);
+
+      void addEvent(double time, RenderEvent::Type type,
+                    mopo_float note = 0.0, mopo_float value = 0.0,
+                    const std::string& control = "");
+      // _offset_ is the sample in the next buffer the event happens at.
+      void processEvent(const RenderEvent& event, int offset);
+
+      CursynthEngine synth_;
+      control_map controls_;
+      unsigned sample_rate_;
+      unsigned buffer_size_;
+
+      std::vector<RenderEvent> events_;
+      double end_time_;
+  };
+} // namespace mopo
+
+#endif // CURSYNTH_RENDER_H
@@ -36,6 +36,13 @@ namespace mopo {
     "on"
   };
 
+  const char* CursynthStrings::voice_steal_strings_[] = {
+    "oldest",
+    "quietest",
+    "released",
+    "same note"
+  };
+
   const char* CursynthStrings::wave_strings_[] = {
     "sin",
     "triangle",
@@ -26,6 +26,7 @@ namespace mopo {
       static const char* filter_strings_[];
       static const char* legato_strings_[];
       static const char* portamento_strings_[];
+      static const char* voice_steal_strings_[];
       static const char* wave_strings_[];
   };
 } // namespace mopo
@@ -15,6 +15,7 @@
  */
 
 #include "cursynth.h"
+#include "cursynth_render.h"
 #include <iostream>
 #include <stdlib.h>
 #include <getopt.h>
@@ -22,6 +23,11 @@
 int main(int argc, char **argv) {
   unsigned buffer_size = mopo::DEFAULT_BUFFER_SIZE;
   unsigned sample_rate = mopo::DEFAULT_SAMPLE_RATE;
+  bool voice_bank = false;
+  int voice_threads = 1;
+  std::string render_file;
+  std::string patch_file;
+  std::string events_file;
 
   int getopt_response = 0;
   int digit_optind = 0;
@@ -30,12 +36,17 @@ int main(int argc, char **argv) {
     static const struct option long_options[] = {
       {"sample-rate", required_argument, 0, 's'},
       {"buffer-size", required_argument, 0, 'b'},
+      {"voice-bank", no_argument, 0, 'k'},
+      {"voice-threads", required_argument, 0, 't'},
+      {"render", required_argument, 0, 'r'},
+      {"patch", required_argument, 0, 'p'},
+      {"events", required_argument, 0, 'e'},
       {"version", no_argument, 0, 'V'},
       {0, 0, 0, 0}
     };
 
     int option_index = 0;
-    getopt_response = getopt_long(argc, argv, "s:b:V",
+    getopt_response = getopt_long(argc, argv, "s:b:kt:r:p:e:V",
                                   long_options, &option_index);
 
     switch (getopt_response) {
@@ -45,6 +56,21 @@ int main(int argc, char **argv) {
       case 'b':
         buffer_size = atoi(optarg);
         break;
+      case 'k':
+        voice_bank = true;
+        break;
+      case 't':
+        voice_threads = atoi(optarg);
+        break;
+      case 'r':
+        render_file = optarg;
+        break;
+      case 'p':
+        patch_file = optarg;
+        break;
+      case 'e':
+        events_file = optarg;
+        break;
       case 'V':
         std::cout << "Cursynth " << VERSION << std::endl;
         exit(EXIT_SUCCESS);
@@ -57,6 +83,15 @@ int main(int argc, char **argv) {
                   << std::endl
                   << "         [--sample-rate OR -s preferred-sample-rate]"
                   << std::endl
+                  << "         [--voice-bank OR -k]"
+                  << std::endl
+                  << "         [--voice-threads OR -t number-of-threads]"
+                  << std::endl
+                  << "         [--render OR -r output.wav"
+                  << " --events OR -e events-or-midi-file"
+                  << std::endl
+                  << "          [--patch OR -p patch.mite]]"
+                  << std::endl
                   << "         [--version OR -V]"
                   << std::endl;
         exit(EXIT_FAILURE);
@@ -64,7 +99,26 @@ int main(int argc, char **argv) {
     }
   }
 
+  // Offline rendering doesn't need audio, MIDI or terminal devices.
+  if (render_file.length()) {
+    if (events_file.empty()) {
+      std::cerr << "--render needs an --events file" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    mopo::CursynthRender render(sample_rate, buffer_size);
+    render.setVoiceBank(voice_bank);
+    render.setVoiceThreads(voice_threads);
+    if ((patch_file.length() && !render.loadPatch(patch_file)) ||
+        !render.loadEvents(events_file) || !render.render(render_file)) {
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+  }
+
   mopo::Cursynth cursynth;
+  cursynth.setVoiceBank(voice_bank);
+  cursynth.setVoiceThreads(voice_threads);
   cursynth.start(sample_rate, buffer_size);
 
   return 0;